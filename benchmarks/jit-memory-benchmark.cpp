@@ -0,0 +1,132 @@
+#include <formula/formula.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Mode
+{
+    const char *name;
+    formula::JitMemory memory;
+    bool hot; // Mark the measured hot formulas
+};
+
+// Formula indices to call, with a few percent of the formulas taking most of the calls.  The
+// hot formulas are scattered over the order of creation, as they would be in an application.
+std::vector<std::uint32_t> make_calls(std::size_t formulas, std::size_t calls)
+{
+    std::mt19937 random(42);
+    std::vector<double> weights(formulas);
+    for (std::size_t i = 0; i < formulas; ++i)
+    {
+        weights[i] = 1.0 / static_cast<double>(i + 1);
+    }
+    std::discrete_distribution<std::uint32_t> distribution(weights.begin(), weights.end());
+    std::vector<std::uint32_t> order(formulas);
+    std::iota(order.begin(), order.end(), 0U);
+    std::shuffle(order.begin(), order.end(), random);
+
+    std::vector<std::uint32_t> result(calls);
+    for (std::uint32_t &call : result)
+    {
+        call = order[distribution(random)];
+    }
+    return result;
+}
+
+// Profiles the first calls and marks the most called formulas as hot.
+std::vector<bool> measure_hotness(std::size_t formulas, const std::vector<std::uint32_t> &calls, double fraction)
+{
+    std::vector<std::size_t> counts(formulas);
+    for (std::size_t i = 0; i < calls.size() / 10; ++i)
+    {
+        ++counts[calls[i]];
+    }
+    std::vector<std::uint32_t> ranked(formulas);
+    std::iota(ranked.begin(), ranked.end(), 0U);
+    const std::size_t hot_count = static_cast<std::size_t>(static_cast<double>(formulas) * fraction);
+    std::partial_sort(ranked.begin(), ranked.begin() + hot_count, ranked.end(),
+        [&](std::uint32_t left, std::uint32_t right) { return counts[left] > counts[right]; });
+    std::vector<bool> hot(formulas);
+    for (std::size_t i = 0; i < hot_count; ++i)
+    {
+        hot[ranked[i]] = true;
+    }
+    return hot;
+}
+
+bool measure(const Mode &mode, std::size_t count, const std::vector<std::uint32_t> &calls, const std::vector<bool> &hot)
+{
+    formula::set_jit_memory(mode.memory);
+    std::vector<std::shared_ptr<formula::Formula>> formulas;
+    formulas.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const std::string text = "a*" + std::to_string(i + 1) + " + b*b - a/(b + " + std::to_string(i % 97 + 2) + ")";
+        std::shared_ptr<formula::Formula> formula = formula::parse_fast(text);
+        formula->set_log_file(nullptr);
+        formula->set_batch_variables({"a", "b"});
+        formula->set_hot(mode.hot && hot[i]);
+        if (!formula->compile_batch())
+        {
+            return false;
+        }
+        formulas.push_back(std::move(formula));
+    }
+
+    const double a{1.5};
+    const double b{0.25};
+    const double *columns[]{&a, &b};
+    double checksum{};
+    const auto start = std::chrono::steady_clock::now();
+    for (std::uint32_t call : calls)
+    {
+        double result;
+        formulas[call]->evaluate_batch(columns, &result, 1);
+        checksum += result;
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << mode.name << ": " << elapsed.count() * 1e9 / static_cast<double>(calls.size())
+              << " ns per call (checksum " << checksum << ")\n";
+    return true;
+}
+
+} // namespace
+
+// Calls single row batch kernels of many live formulas with each kind of JIT memory.  Run it
+// under perf stat -e iTLB-load-misses,iTLB-loads with one mode at a time to see the misses.
+int main(int argc, char *argv[])
+{
+    const std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    const std::size_t call_count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 20000000;
+    const int only = argc > 3 ? std::atoi(argv[3]) : -1;
+    const Mode modes[]{
+        {"private memory", {false, false}, false},
+        {"shared memory", {true, false}, false},
+        {"shared large pages", {true, true}, false},
+        {"shared large pages, hot apart", {true, true}, true},
+    };
+
+    const std::vector<std::uint32_t> calls = make_calls(count, call_count);
+    const std::vector<bool> hot = measure_hotness(count, calls, 0.05);
+    for (int i = 0; i < static_cast<int>(std::size(modes)); ++i)
+    {
+        if ((only < 0 || only == i) && !measure(modes[i], count, calls, hot))
+        {
+            std::cerr << "Error: Failed to compile formula\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <formula/formula.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Builds random expressions using every construct of the grammar.
+std::string generate(std::mt19937 &random, int depth)
+{
+    std::uniform_int_distribution<int> pick(0, 5);
+    const int choice = depth == 0 ? pick(random) % 2 : pick(random);
+    if (choice == 0)
+    {
+        return std::to_string(std::uniform_real_distribution<double>(0.0, 100.0)(random));
+    }
+    if (choice == 1)
+    {
+        return "x" + std::to_string(random() % 8);
+    }
+    if (choice == 2)
+    {
+        return "-(" + generate(random, depth - 1) + ")";
+    }
+    static const char ops[] = "+-*/";
+    return generate(random, depth - 1) + ' ' + ops[random() % 4] + ' ' + generate(random, depth - 1);
+}
+
+template <typename Parse>
+double measure(const char *name, const std::vector<std::string> &texts, Parse parse)
+{
+    const auto start = std::chrono::steady_clock::now();
+    std::size_t parsed{};
+    for (const std::string &text : texts)
+    {
+        parsed += parse(text) ? 1 : 0;
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": " << parsed << '/' << texts.size() << " parsed in " << elapsed.count() << "s ("
+              << elapsed.count() * 1e9 / texts.size() << " ns per formula)\n";
+    return elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    std::mt19937 random(42);
+    std::vector<std::string> texts;
+    texts.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        texts.push_back(generate(random, 6));
+    }
+
+    const double slow = measure("parse", texts, [](const std::string &text) { return formula::parse(text); });
+    const double fast =
+        measure("parse_fast", texts, [](const std::string &text) { return formula::parse_fast(text); });
+    std::cout << "Speedup: " << slow / fast << "x\n";
+    return 0;
+}
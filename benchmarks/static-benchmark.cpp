@@ -0,0 +1,87 @@
+#include <formula/formula.h>
+#include <formula/static_formula.h>
+
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+constexpr char TEXT[] = "a*a*a - 2*a*b + b/4 - (a - b)*(a + b)*0.5 + 1.5";
+
+template <typename Evaluate>
+double measure(const char *name, std::size_t repeat, std::vector<double> &results, Evaluate evaluate)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < repeat; ++i)
+    {
+        evaluate();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    double checksum{};
+    for (double result : results)
+    {
+        checksum += result;
+    }
+    const double rows = static_cast<double>(repeat * results.size());
+    std::cout << name << ": " << elapsed.count() * 1e9 / rows << " ns per row (checksum " << checksum << ")\n";
+    return elapsed.count();
+}
+
+} // namespace
+
+// Evaluates the same formula over the same rows with the compile time specialization, the
+// JIT compiled batch kernel and the interpreter.
+int main(int argc, char *argv[])
+{
+    const std::size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 4096;
+    const std::size_t repeat = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> distribution(-10.0, 10.0);
+    std::vector<double> a(count);
+    std::vector<double> b(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        a[i] = distribution(random);
+        b[i] = distribution(random);
+    }
+    const double *columns[]{a.data(), b.data()};
+    std::vector<double> results(count);
+
+    formula::StaticFormula<TEXT> specialized;
+    constexpr std::size_t a_slot{formula::StaticFormula<TEXT>::slot("a")};
+    constexpr std::size_t b_slot{formula::StaticFormula<TEXT>::slot("b")};
+    const double static_time = measure("static", repeat, results,
+        [&]
+        {
+            for (std::size_t row = 0; row < count; ++row)
+            {
+                specialized.set_value(a_slot, a[row]);
+                specialized.set_value(b_slot, b[row]);
+                results[row] = specialized.evaluate();
+            }
+        });
+
+    const auto jit = formula::parse(TEXT);
+    jit->set_log_file(nullptr);
+    jit->set_batch_variables({"a", "b"});
+    if (!jit->compile_batch())
+    {
+        std::cerr << "Error: Failed to compile formula\n";
+        return 1;
+    }
+    const double jit_time = measure(
+        "jit batch", repeat, results, [&] { jit->evaluate_batch(columns, results.data(), count); });
+
+    const auto interpreted = formula::parse(TEXT);
+    interpreted->set_batch_variables({"a", "b"});
+    measure("interpreter", std::max<std::size_t>(repeat / 100, 1), results,
+        [&] { interpreted->evaluate_batch(columns, results.data(), count); });
+
+    std::cout << "Static/JIT time ratio: " << static_time / jit_time << '\n';
+    return 0;
+}
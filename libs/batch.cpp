@@ -0,0 +1,502 @@
+#include "parsed_formula.h"
+
+#include <cstring>
+#include <limits>
+
+namespace formula
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Bitwise comparison, so a change of sign of zero or of a NaN payload counts as a change.
+bool all_bits_equal(const double *values, std::size_t count, double value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return std::all_of(values, values + count,
+        [bits](double other)
+        {
+            std::uint64_t other_bits;
+            std::memcpy(&other_bits, &other, sizeof(other_bits));
+            return other_bits == bits;
+        });
+}
+
+double reduction_identity(Reduction reduction)
+{
+    if (reduction == Reduction::Min)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    if (reduction == Reduction::Max)
+    {
+        return -std::numeric_limits<double>::infinity();
+    }
+    return 0.0;
+}
+
+// Same operand order as minsd/maxsd so the interpreter and compiled code agree.
+double reduce_value(Reduction reduction, double accumulator, double value)
+{
+    if (reduction == Reduction::Min)
+    {
+        return accumulator < value ? accumulator : value;
+    }
+    if (reduction == Reduction::Max)
+    {
+        return accumulator > value ? accumulator : value;
+    }
+    return accumulator + value;
+}
+
+void emit_reduction(asmjit::x86::Compiler &comp, EmitterState &state, Reduction reduction,
+    asmjit::x86::Xmm accumulator, asmjit::x86::Xmm value)
+{
+    using Inst = asmjit::x86::Inst;
+    if (reduction == Reduction::Min)
+    {
+        comp.emit(sse_inst(state, Inst::kIdMinsd, Inst::kIdMinpd, Inst::kIdMinss, Inst::kIdMinps), accumulator, value);
+    }
+    else if (reduction == Reduction::Max)
+    {
+        comp.emit(sse_inst(state, Inst::kIdMaxsd, Inst::kIdMaxpd, Inst::kIdMaxss, Inst::kIdMaxps), accumulator, value);
+    }
+    else
+    {
+        emit_arithmetic(comp, state, '+', accumulator, value);
+    }
+}
+
+} // namespace
+
+template <typename T, typename Consumer>
+void ParsedFormula::interpret_rows(const T *const *columns, std::size_t count, Consumer consume)
+{
+    SymbolTable symbols{m_state.symbols};
+    std::vector<double *> slots;
+    for (const std::string &name : m_batch_variables)
+    {
+        slots.push_back(&symbols[name]);
+    }
+    symbols[RANDOM_SEED] = m_random.seed;
+    symbols[RANDOM_STREAM] = m_random.stream;
+    double &random_row = symbols[RANDOM_ROW];
+    for (std::size_t row = 0; row < count; ++row)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            *slots[i] = columns[i][row];
+        }
+        random_row = static_cast<double>(m_random.row + row);
+        consume(row, m_ast->evaluate(symbols));
+    }
+    m_random.row += count;
+}
+
+template <typename T>
+double ParsedFormula::interpret_reduction(Reduction reduction, const T *const *columns, std::size_t count)
+{
+    double result = reduction_identity(reduction);
+    interpret_rows(columns, count,
+        [&result, reduction](std::size_t, double value) { result = reduce_value(reduction, result, value); });
+    return reduction == Reduction::Mean ? result / static_cast<double>(count) : result;
+}
+
+void ParsedFormula::evaluate_batch(const double *const *columns, double *results, std::size_t count)
+{
+    std::vector<const double *> remaining;
+    if (m_specialized_batch_function)
+    {
+        const auto done = static_cast<std::size_t>(m_specialized_batch_function(columns, results, count));
+        if (done == count)
+        {
+            return;
+        }
+        // A specialized value differs from row done on, where the generic kernel takes over and
+        // profiling starts over
+        reset_specialization();
+        for (size_t i = 0; i < m_batch_variables.size(); ++i)
+        {
+            remaining.push_back(columns[i] + done);
+        }
+        columns = remaining.data();
+        results += done;
+        count -= done;
+    }
+    if (m_batch_function)
+    {
+        if (m_specialization_threshold)
+        {
+            profile_values(columns, count);
+        }
+        m_batch_function(columns, results, count);
+        return;
+    }
+
+    interpret_rows(columns, count, [results](std::size_t row, double value) { results[row] = value; });
+}
+
+void ParsedFormula::evaluate_batch(const float *const *columns, float *results, std::size_t count)
+{
+    if (m_float_batch_function)
+    {
+        m_float_batch_function(columns, results, count);
+        return;
+    }
+
+    interpret_rows(
+        columns, count, [results](std::size_t row, double value) { results[row] = static_cast<float>(value); });
+}
+
+double ParsedFormula::reduce(Reduction reduction, const double *const *columns, std::size_t count)
+{
+    if (BatchFunction *function = m_reduction_functions[static_cast<size_t>(reduction)])
+    {
+        return function(columns, nullptr, count);
+    }
+
+    return interpret_reduction(reduction, columns, count);
+}
+
+double ParsedFormula::reduce(Reduction reduction, const float *const *columns, std::size_t count)
+{
+    if (FloatBatchFunction *function = m_float_reduction_functions[static_cast<size_t>(reduction)])
+    {
+        return function(columns, nullptr, count);
+    }
+
+    return interpret_reduction(reduction, columns, count);
+}
+
+bool ParsedFormula::compile_batch()
+{
+    if (m_precision == Precision::Double)
+    {
+        return compile_batch_kernel(m_batch_function, std::nullopt);
+    }
+    return compile_batch_kernel(m_float_batch_function, std::nullopt);
+}
+
+// Comparisons stop at the first differing row, which keeps varying columns cheap; only the
+// stable candidates are scanned in full.
+void ParsedFormula::profile_values(const double *const *columns, std::size_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    if (m_profiled_calls == 0)
+    {
+        const VariableSet read = variables();
+        m_value_profiles.assign(m_batch_variables.size(), ValueProfile{});
+        for (size_t i = 0; i < m_batch_variables.size(); ++i)
+        {
+            m_value_profiles[i].value = columns[i][0];
+            m_value_profiles[i].varying = read.count(m_batch_variables[i]) == 0;
+        }
+    }
+
+    bool stable{};
+    for (size_t i = 0; i < m_value_profiles.size(); ++i)
+    {
+        ValueProfile &profile = m_value_profiles[i];
+        profile.varying = profile.varying || !all_bits_equal(columns[i], count, profile.value);
+        stable = stable || !profile.varying;
+    }
+    if (!stable)
+    {
+        m_profiled_calls = 0;
+        return;
+    }
+    if (++m_profiled_calls < m_specialization_threshold)
+    {
+        return;
+    }
+
+    SymbolTable constants;
+    for (size_t i = 0; i < m_value_profiles.size(); ++i)
+    {
+        if (!m_value_profiles[i].varying)
+        {
+            constants[m_batch_variables[i]] = m_value_profiles[i].value;
+            m_specialized_values.emplace_back(i, m_value_profiles[i].value);
+        }
+    }
+    std::shared_ptr<Node> generic = m_ast;
+    if (std::shared_ptr<Node> specialized = m_ast->specialize(constants))
+    {
+        m_ast = std::move(specialized);
+    }
+    BatchFunction *function{};
+    const bool compiled = compile_batch_kernel(function, std::nullopt, m_specialized_values);
+    m_ast = std::move(generic);
+    m_profiled_calls = 0;
+    if (!compiled)
+    {
+        m_specialized_values.clear();
+        return;
+    }
+    m_specialized_batch_function = function;
+}
+
+std::vector<std::string> ParsedFormula::specialized_variables() const
+{
+    std::vector<std::string> names;
+    for (const auto &[index, value] : m_specialized_values)
+    {
+        names.push_back(m_batch_variables[index]);
+    }
+    return names;
+}
+
+bool ParsedFormula::compile_reduction(Reduction reduction)
+{
+    const size_t index = static_cast<size_t>(reduction);
+    if (m_precision == Precision::Double)
+    {
+        return compile_batch_kernel(m_reduction_functions[index], reduction);
+    }
+    return compile_batch_kernel(m_float_reduction_functions[index], reduction);
+}
+
+// Emits a loop over the rows of the batch columns.  The main loop evaluates a full XMM
+// register of rows at a time; reductions unroll it over several independent accumulators
+// to hide the latency of the reduction operation and only the final value leaves the
+// registers.  A scalar loop handles the remaining rows.
+//
+// Double precision kernels read double columns.  Single precision kernels read float
+// columns and compute four rows per register; mixed precision kernels read float columns
+// and compute in double precision, two rows per register.
+// A kernel with guards compares the values of the specialized variables as it loads them
+// and stops ahead of the first step where they differ, returning its row.
+template <typename Function>
+bool ParsedFormula::compile_batch_kernel(
+    Function *&function, std::optional<Reduction> reduction, const SpecializedValues &guards)
+{
+    const bool float_data{m_precision != Precision::Double};
+    const bool single{m_precision == Precision::Single};
+    const size_t lanes{single ? 4U : 2U};
+    const uint32_t shift{float_data ? 2U : 3U};
+    const size_t element_size{float_data ? sizeof(float) : sizeof(double)};
+    const size_t unroll{reduction ? 4U : 1U};
+    const size_t step{lanes * unroll};
+
+    function = nullptr;
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    m_state.single = single;
+    asmjit::x86::Compiler comp(&code);
+    asmjit::x86::Gp columns;
+    asmjit::x86::Gp results;
+    asmjit::x86::Gp count;
+    begin_function(comp, asmjit::FuncSignature::build<double, const void *const *, void *, std::size_t>(),
+        {{&columns, "columns"}, {&results, "results"}, {&count, "count"}});
+
+    // Moves between the columns and the arithmetic registers
+    const auto load_input = [&](asmjit::x86::Xmm input, const asmjit::x86::Mem &mem)
+    {
+        if (single)
+        {
+            m_state.packed ? comp.movups(input, mem) : comp.movss(input, mem);
+        }
+        else if (float_data)
+        {
+            m_state.packed ? comp.movsd(input, mem) : comp.movss(input, mem);
+            m_state.packed ? comp.cvtps2pd(input, input) : comp.cvtss2sd(input, input);
+        }
+        else
+        {
+            m_state.packed ? comp.movupd(input, mem) : comp.movsd(input, mem);
+        }
+    };
+    const auto store_output = [&](const asmjit::x86::Mem &mem, asmjit::x86::Xmm value)
+    {
+        if (single)
+        {
+            m_state.packed ? comp.movups(mem, value) : comp.movss(mem, value);
+        }
+        else if (float_data)
+        {
+            asmjit::x86::Xmm narrow = comp.newXmmPs();
+            m_state.packed ? comp.cvtpd2ps(narrow, value) : comp.cvtsd2ss(narrow, value);
+            m_state.packed ? comp.movsd(mem, narrow) : comp.movss(mem, narrow);
+        }
+        else
+        {
+            m_state.packed ? comp.movupd(mem, value) : comp.movsd(mem, value);
+        }
+    };
+
+    // Columns the formula doesn't read are never loaded; those of specialized variables only
+    // by the guards
+    const std::vector<bool> reads = read_columns();
+    std::vector<bool> loaded{reads};
+    for (const auto &guard : guards)
+    {
+        loaded[guard.first] = true;
+    }
+    const std::vector<asmjit::x86::Gp> bases = load_bases(comp, columns, loaded);
+    asmjit::x86::Gp row = comp.newIntPtr("row");
+    m_state.random = RandomRegisters{&m_random, row};
+
+    asmjit::x86::Xmm result = new_value_register(comp, m_state);
+    std::vector<asmjit::x86::Xmm> accumulators;
+    m_state.packed = true;
+    m_state.preheader = comp.cursor(); // Invariants are broadcast once, ahead of both loops
+    if (reduction)
+    {
+        for (size_t i = 0; i < unroll; ++i)
+        {
+            asmjit::x86::Xmm accumulator = new_value_register(comp, m_state);
+            load_constant(comp, m_state, accumulator, reduction_identity(*reduction));
+            accumulators.push_back(accumulator);
+        }
+    }
+
+    asmjit::Label done = comp.newLabel();
+    const auto emit_guards = [&]
+    {
+        if (!m_state.packed)
+        {
+            for (const auto &[column, value] : guards)
+            {
+                asmjit::x86::Gp loaded = comp.newInt64("loaded");
+                comp.mov(loaded, asmjit::x86::qword_ptr(bases[column], row, shift));
+                asmjit::x86::Gp expected = comp.newInt64("expected");
+                comp.mov(expected, constant_bits(m_state, value));
+                comp.cmp(loaded, expected);
+                comp.jne(done);
+            }
+            return;
+        }
+        if (guards.empty())
+        {
+            return;
+        }
+        // One branch per step on the bitwise equality of all the loaded values
+        std::optional<asmjit::x86::Xmm> equal;
+        for (const auto &[column, value] : guards)
+        {
+            for (size_t i = 0; i < unroll; ++i)
+            {
+                asmjit::x86::Xmm loaded = comp.newXmm();
+                comp.movupd(loaded,
+                    asmjit::x86::ptr(bases[column], row, shift, static_cast<int32_t>(i * lanes * element_size)));
+                asmjit::x86::Xmm expected = comp.newXmm();
+                load_bits(comp, m_state, expected, constant_bits(m_state, value));
+                comp.pcmpeqd(loaded, expected);
+                if (equal)
+                {
+                    comp.pand(*equal, loaded);
+                }
+                else
+                {
+                    equal = loaded;
+                }
+            }
+        }
+        asmjit::x86::Gp mask = comp.newInt32("mask");
+        comp.pmovmskb(mask, *equal);
+        comp.cmp(mask, 0xFFFF);
+        comp.jne(done);
+    };
+    const auto emit_rows = [&]
+    {
+        emit_guards();
+        for (size_t i = 0; i < (m_state.packed ? unroll : 1U); ++i)
+        {
+            const int32_t offset = static_cast<int32_t>(i * lanes * element_size);
+            m_state.random->offset = static_cast<int32_t>(i * lanes);
+            bind_inputs(m_state.registers, reads,
+                [&](size_t column)
+                {
+                    asmjit::x86::Xmm input = new_value_register(comp, m_state);
+                    load_input(input, asmjit::x86::ptr(bases[column], row, shift, offset));
+                    return input;
+                });
+            asmjit::x86::Xmm value = new_value_register(comp, m_state);
+            if (!m_ast->compile(comp, m_state, value))
+            {
+                return false;
+            }
+            if (reduction)
+            {
+                emit_reduction(comp, m_state, *reduction, m_state.packed ? accumulators[i] : result, value);
+            }
+            else
+            {
+                store_output(asmjit::x86::ptr(results, row, shift, offset), value);
+            }
+        }
+        return true;
+    };
+    // The lanes of the accumulators are combined into the result the scalar loop continues
+    const auto combine = [&]
+    {
+        if (!reduction)
+        {
+            comp.xorpd(result, result);
+            return;
+        }
+        for (size_t i = 1; i < unroll; ++i)
+        {
+            emit_reduction(comp, m_state, *reduction, accumulators[0], accumulators[i]);
+        }
+        asmjit::x86::Xmm high = new_value_register(comp, m_state);
+        if (single)
+        {
+            comp.movaps(high, accumulators[0]);
+            comp.movhlps(high, accumulators[0]);
+            emit_reduction(comp, m_state, *reduction, accumulators[0], high);
+            comp.movaps(high, accumulators[0]);
+            comp.shufps(high, high, 0x55);
+        }
+        else
+        {
+            comp.movapd(high, accumulators[0]);
+            comp.unpckhpd(high, high);
+        }
+        m_state.packed = false;
+        comp.movapd(result, accumulators[0]);
+        emit_reduction(comp, m_state, *reduction, result, high);
+    };
+    if (!emit_row_loop(comp, row, count, step, done, emit_rows, combine))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    if (m_state.random->used)
+    {
+        comp.add(asmjit::x86::qword_ptr(m_state.random->address, offsetof(RandomState, row)), row);
+    }
+    if (!guards.empty())
+    {
+        comp.cvtsi2sd(result, row);
+    }
+
+    if (reduction == Reduction::Mean)
+    {
+        asmjit::x86::Xmm rows = new_value_register(comp, m_state);
+        single ? comp.cvtsi2ss(rows, count) : comp.cvtsi2sd(rows, count);
+        emit_arithmetic(comp, m_state, '/', result, rows);
+    }
+    if (single)
+    {
+        asmjit::x86::Xmm wide = comp.newXmmSd();
+        comp.cvtss2sd(wide, result);
+        result = wide;
+    }
+    comp.ret(result);
+    return finish_function(comp, code, function, "batch formula");
+}
+
+} // namespace internal
+
+} // namespace formula
@@ -0,0 +1,741 @@
+#include "nodes.h"
+#include "packed_math.h"
+#include "random.h"
+
+#include <iostream>
+
+namespace formula
+{
+
+namespace internal
+{
+
+namespace
+{
+
+template <typename Emitter>
+asmjit::Label get_identifier_label(Emitter &assem, EmitterState &state, const std::string &name)
+{
+    if (const auto &it = state.symbols.find(name); it != state.symbols.end())
+    {
+        return get_symbol_label(assem, state.data.symbols, it->first);
+    }
+    return get_constant_label(assem, state.data.constants, 0.0);
+}
+
+asmjit::FuncSignature native_signature(std::size_t arity)
+{
+    switch (arity)
+    {
+    case 0:
+        return asmjit::FuncSignature::build<double>();
+    case 1:
+        return asmjit::FuncSignature::build<double, double>();
+    case 2:
+        return asmjit::FuncSignature::build<double, double, double>();
+    case 3:
+        return asmjit::FuncSignature::build<double, double, double, double>();
+    default:
+        return asmjit::FuncSignature::build<double, double, double, double, double>();
+    }
+}
+
+// A lane of a packed value as a double in the low lane.
+asmjit::x86::Xmm lane_value(
+    asmjit::x86::Compiler &comp, const EmitterState &state, asmjit::x86::Xmm value, std::uint32_t lane)
+{
+    if (lane == 0 && !state.single)
+    {
+        return value;
+    }
+    asmjit::x86::Xmm result = comp.newXmm();
+    if (state.single)
+    {
+        comp.pshufd(result, value, lane);
+        comp.cvtss2sd(result, result);
+    }
+    else
+    {
+        comp.movapd(result, value);
+        comp.unpckhpd(result, result);
+    }
+    return result;
+}
+
+} // namespace
+
+bool NumberNode::assemble(asmjit::x86::Assembler &assem, EmitterState &state) const
+{
+    asmjit::Label label = get_constant_label(assem, state.data.constants, m_value);
+    assem.movq(asmjit::x86::xmm0, asmjit::x86::ptr(label));
+    return true;
+}
+
+bool NumberNode::compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const
+{
+    load_constant(comp, state, result, m_value);
+    return true;
+}
+
+bool NumberNode::compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+    const TangentRegisters &gradient) const
+{
+    for (const asmjit::x86::Xmm &tangent : gradient)
+    {
+        comp.xorpd(tangent, tangent);
+    }
+    return compile(comp, state, result);
+}
+
+bool NumberNode::compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const
+{
+    comp.mov(result, to_fixed(m_value, state.integer->fraction_bits));
+    return true;
+}
+
+bool IdentifierNode::assemble(asmjit::x86::Assembler &assem, EmitterState &state) const
+{
+    asmjit::Label label{get_identifier_label(assem, state, m_name)};
+    assem.movq(asmjit::x86::xmm0, asmjit::x86::ptr(label));
+    return true;
+}
+
+bool IdentifierNode::compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const
+{
+    if (const auto it = state.registers.find(m_name); it != state.registers.end())
+    {
+        comp.movapd(result, it->second);
+        return true;
+    }
+    if (state.complex ? !state.complex->count(m_name) : !state.symbols.count(m_name))
+    {
+        load_constant(comp, state, result, 0.0);
+        return true;
+    }
+    load_invariant(comp, state, state.symbol_registers, m_name, result,
+        [&](asmjit::x86::Xmm value)
+        { load_value(comp, state, value, get_symbol_label(comp, state.data.symbols, m_name)); });
+    return true;
+}
+
+bool IdentifierNode::compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+    const TangentRegisters &gradient) const
+{
+    for (size_t i = 0; i < gradient.size(); ++i)
+    {
+        if (state.variables[i] == m_name)
+        {
+            load_constant(comp, state, gradient[i], 1.0);
+        }
+        else
+        {
+            comp.xorpd(gradient[i], gradient[i]);
+        }
+    }
+    return compile(comp, state, result);
+}
+
+bool IdentifierNode::compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const
+{
+    if (const auto it = state.integer_registers.find(m_name); it != state.integer_registers.end())
+    {
+        comp.mov(result, it->second);
+        return true;
+    }
+    if (state.symbols.find(m_name) == state.symbols.end())
+    {
+        comp.xor_(result, result);
+        return true;
+    }
+    comp.mov(result, asmjit::x86::qword_ptr(get_symbol_label(comp, state.data.symbols, m_name)));
+    return true;
+}
+
+bool UnaryOpNode::assemble(asmjit::x86::Assembler &assem, EmitterState &state) const
+{
+    if (m_op == '+')
+    {
+        return m_operand->assemble(assem, state);
+    }
+    if (m_op == '-')
+    {
+        if (!m_operand->assemble(assem, state))
+        {
+            return false;
+        }
+        assem.xorpd(asmjit::x86::xmm1, asmjit::x86::xmm1);
+        assem.subsd(asmjit::x86::xmm1, asmjit::x86::xmm0);
+        assem.movsd(asmjit::x86::xmm0, asmjit::x86::xmm1);
+        return true;
+    }
+
+    return false;
+}
+
+bool UnaryOpNode::compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const
+{
+    if (m_op == '+')
+    {
+        return m_operand->compile(comp, state, result);
+    }
+    if (m_op == '-')
+    {
+        asmjit::x86::Xmm operand{comp.newXmm()};
+        if (!m_operand->compile(comp, state, operand))
+        {
+            return false;
+        }
+        asmjit::x86::Xmm tmp = comp.newXmm();
+        comp.xorpd(tmp, tmp);                            // xmm1 = 0.0
+        emit_arithmetic(comp, state, '-', tmp, operand); // xmm1 = 0.0 - xmm0
+        comp.movapd(result, tmp);                        // xmm0 = xmm1
+        return true;
+    }
+
+    return false;
+}
+
+bool UnaryOpNode::compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+    const TangentRegisters &gradient) const
+{
+    if (m_op == '+')
+    {
+        return m_operand->compile_gradient(comp, state, result, gradient);
+    }
+    if (m_op == '-')
+    {
+        asmjit::x86::Xmm operand{comp.newXmm()};
+        if (!m_operand->compile_gradient(comp, state, operand, gradient))
+        {
+            return false;
+        }
+        asmjit::x86::Xmm tmp = comp.newXmm();
+        comp.xorpd(tmp, tmp);
+        comp.subsd(tmp, operand);
+        comp.movsd(result, tmp);
+        for (const asmjit::x86::Xmm &tangent : gradient)
+        {
+            comp.xorpd(tmp, tmp);
+            comp.subsd(tmp, tangent);
+            comp.movapd(tangent, tmp);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool UnaryOpNode::compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const
+{
+    if (!m_operand->compile_integer(comp, state, result))
+    {
+        return false;
+    }
+    if (m_op == '+')
+    {
+        return true;
+    }
+    if (m_op == '-')
+    {
+        comp.neg(result);
+        if (state.integer->checked)
+        {
+            comp.jo(state.overflow);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+bool BinaryOpNode::assemble(asmjit::x86::Assembler &assem, EmitterState &state) const
+{
+    m_left->assemble(assem, state);
+    assem.movq(asmjit::x86::rax, asmjit::x86::xmm0); // Save left operand
+    assem.push(asmjit::x86::rax);                    // Push left operand onto stack
+    m_right->assemble(assem, state);
+    assem.movq(asmjit::x86::xmm1, asmjit::x86::xmm0); // Move right operand to xmm1
+    assem.pop(asmjit::x86::rax);                      // Load left operand into rax
+    assem.movq(asmjit::x86::xmm0, asmjit::x86::rax);  // Move left operand to xmm0
+    if (m_op == '+')
+    {
+        assem.addsd(asmjit::x86::xmm0, asmjit::x86::xmm1); // xmm0 = xmm0 + xmm1
+        return true;
+    }
+    if (m_op == '-')
+    {
+        assem.subsd(asmjit::x86::xmm0, asmjit::x86::xmm1); // xmm0 = xmm0 - xmm1
+        return true;
+    }
+    if (m_op == '*')
+    {
+        assem.mulsd(asmjit::x86::xmm0, asmjit::x86::xmm1); // xmm0 = xmm0 * xmm1
+        return true;
+    }
+    if (m_op == '/')
+    {
+        assem.divsd(asmjit::x86::xmm0, asmjit::x86::xmm1); // xmm0 = xmm0 / xmm1
+        return true;
+    }
+    return false;
+}
+
+bool BinaryOpNode::compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const
+{
+    asmjit::x86::Xmm right{comp.newXmm()};
+    if (!m_left->compile(comp, state, result) || !m_right->compile(comp, state, right))
+    {
+        return false;
+    }
+    return emit_arithmetic(comp, state, m_op, result, right); // xmm0 = xmm0 op xmm1
+}
+
+bool BinaryOpNode::compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+    const TangentRegisters &gradient) const
+{
+    if (!m_left->compile_gradient(comp, state, result, gradient))
+    {
+        return false;
+    }
+    asmjit::x86::Xmm right{comp.newXmm()};
+    TangentRegisters right_gradient;
+    for (size_t i = 0; i < gradient.size(); ++i)
+    {
+        right_gradient.push_back(comp.newXmm());
+    }
+    if (!m_right->compile_gradient(comp, state, right, right_gradient))
+    {
+        return false;
+    }
+    if (m_op == '+')
+    {
+        comp.addsd(result, right);
+        for (size_t i = 0; i < gradient.size(); ++i)
+        {
+            comp.addsd(gradient[i], right_gradient[i]);
+        }
+        return true;
+    }
+    if (m_op == '-')
+    {
+        comp.subsd(result, right);
+        for (size_t i = 0; i < gradient.size(); ++i)
+        {
+            comp.subsd(gradient[i], right_gradient[i]);
+        }
+        return true;
+    }
+    asmjit::x86::Xmm tmp{comp.newXmm()};
+    if (m_op == '*')
+    {
+        // (uv)' = u'v + uv'
+        for (size_t i = 0; i < gradient.size(); ++i)
+        {
+            comp.mulsd(gradient[i], right);
+            comp.movapd(tmp, right_gradient[i]);
+            comp.mulsd(tmp, result);
+            comp.addsd(gradient[i], tmp);
+        }
+        comp.mulsd(result, right);
+        return true;
+    }
+    if (m_op == '/')
+    {
+        // (u/v)' = (u' - (u/v)v')/v
+        comp.divsd(result, right);
+        for (size_t i = 0; i < gradient.size(); ++i)
+        {
+            comp.movapd(tmp, right_gradient[i]);
+            comp.mulsd(tmp, result);
+            comp.subsd(gradient[i], tmp);
+            comp.divsd(gradient[i], right);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool BinaryOpNode::compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const
+{
+    if (!m_left->compile_integer(comp, state, result))
+    {
+        return false;
+    }
+    asmjit::x86::Gp right{comp.newInt64()};
+    if (!m_right->compile_integer(comp, state, right))
+    {
+        return false;
+    }
+    return emit_integer_arithmetic(comp, state, m_op, result, right);
+}
+
+bool PowerNode::assemble(asmjit::x86::Assembler & /*assem*/, EmitterState & /*state*/) const
+{
+    std::cerr << "The power operator is not supported by the assembler; use compile\n";
+    return false;
+}
+
+bool PowerNode::compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const
+{
+    if (!m_base->compile(comp, state, result))
+    {
+        return false;
+    }
+    if (m_integer_exponent)
+    {
+        emit_integer_power(comp, state, result, *m_integer_exponent);
+        return true;
+    }
+    if (state.complex)
+    {
+        std::cerr << "Complex formulas need constant integer exponents\n";
+        return false;
+    }
+    asmjit::x86::Xmm exponent{comp.newXmm()};
+    if (!m_exponent->compile(comp, state, exponent))
+    {
+        return false;
+    }
+    PackedMath(comp, state).power(result, result, exponent);
+    return true;
+}
+
+bool PowerNode::compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+    const TangentRegisters &gradient) const
+{
+    if (!m_base->compile_gradient(comp, state, result, gradient))
+    {
+        return false;
+    }
+    asmjit::x86::Xmm slope{comp.newXmm()};
+    if (m_integer_exponent)
+    {
+        const std::int64_t n = m_integer_exponent->value;
+        if (n == 0)
+        {
+            comp.xorpd(slope, slope);
+        }
+        else
+        {
+            comp.movapd(slope, result);
+            emit_integer_power(comp, state, slope, *m_slope_exponent);
+            asmjit::x86::Xmm factor{comp.newXmm()};
+            load_constant(comp, state, factor, static_cast<double>(n));
+            comp.mulsd(slope, factor);
+        }
+        for (const asmjit::x86::Xmm &tangent : gradient)
+        {
+            comp.mulsd(tangent, slope);
+        }
+        emit_integer_power(comp, state, result, *m_integer_exponent);
+        return true;
+    }
+
+    asmjit::x86::Xmm exponent{comp.newXmm()};
+    TangentRegisters exponent_gradient;
+    for (size_t i = 0; i < gradient.size(); ++i)
+    {
+        exponent_gradient.push_back(comp.newXmm());
+    }
+    if (!m_exponent->compile_gradient(comp, state, exponent, exponent_gradient))
+    {
+        return false;
+    }
+    // (u^v)' = v u^(v-1) u' + u^v log(u) v', see evaluate_gradient()
+    PackedMath math(comp, state);
+    asmjit::x86::Xmm tmp{comp.newXmm()};
+    load_constant(comp, state, tmp, 1.0);
+    comp.movapd(slope, exponent);
+    comp.subsd(slope, tmp);
+    math.power(slope, result, slope);
+    comp.mulsd(slope, exponent);
+    asmjit::x86::Xmm log_power{comp.newXmm()};
+    math.log(log_power, result);
+    math.power(result, result, exponent);
+    comp.mulsd(log_power, result);
+    asmjit::x86::Xmm zero{comp.newXmm()};
+    comp.xorpd(zero, zero);
+    for (size_t i = 0; i < gradient.size(); ++i)
+    {
+        comp.mulsd(gradient[i], slope);
+        comp.movapd(tmp, exponent_gradient[i]);
+        comp.cmpsd(tmp, zero, asmjit::Imm(4)); // Not equal
+        comp.andpd(tmp, log_power);
+        comp.mulsd(tmp, exponent_gradient[i]);
+        comp.addsd(gradient[i], tmp);
+    }
+    return true;
+}
+
+bool PowerNode::compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const
+{
+    if (!m_integer_exponent)
+    {
+        std::cerr << "Integer formulas need constant integer exponents\n";
+        return false;
+    }
+    if (!m_base->compile_integer(comp, state, result))
+    {
+        return false;
+    }
+    const std::int64_t one = to_fixed(1.0, state.integer->fraction_bits);
+    const std::int64_t n = m_integer_exponent->value;
+    if (n == 0)
+    {
+        comp.mov(result, one);
+        return true;
+    }
+    const detail::AdditionChain &chain = m_integer_exponent->chain;
+    std::vector<asmjit::x86::Gp> powers{result};
+    for (std::size_t i = 1; i < chain.length; ++i)
+    {
+        asmjit::x86::Gp power = comp.newInt64("power");
+        comp.mov(power, powers.back());
+        emit_integer_arithmetic(comp, state, '*', power, powers[chain.operands[i]]);
+        powers.push_back(power);
+    }
+    if (n < 0)
+    {
+        asmjit::x86::Gp quotient = comp.newInt64("quotient");
+        comp.mov(quotient, one);
+        emit_integer_arithmetic(comp, state, '/', quotient, powers.back());
+        comp.mov(result, quotient);
+    }
+    else if (chain.length > 1)
+    {
+        comp.mov(result, powers.back());
+    }
+    return true;
+}
+
+bool RandomNode::assemble(asmjit::x86::Assembler & /*assem*/, EmitterState & /*state*/) const
+{
+    std::cerr << "Random variables are not supported by the assembler; use compile_batch\n";
+    return false;
+}
+
+// Both lanes run the generator on their own row counter; scalar code uses the low lane.
+bool RandomNode::compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const
+{
+    if (!state.random || state.single)
+    {
+        std::cerr << "Random variables need a double arithmetic batch or reduction kernel\n";
+        return false;
+    }
+    RandomRegisters &random = *state.random;
+    if (!random.used)
+    {
+        asmjit::BaseNode *cursor = comp.setCursor(state.preheader);
+        random.address = comp.newIntPtr("random");
+        comp.mov(random.address, reinterpret_cast<std::uintptr_t>(random.state));
+        random.first_row = comp.newInt64("first_row");
+        comp.mov(random.first_row, asmjit::x86::qword_ptr(random.address, offsetof(RandomState, row)));
+        random.stream_word = comp.newXmm("stream_word");
+        comp.movdqa(random.stream_word, asmjit::x86::xmmword_ptr(random.address, offsetof(RandomState, stream_word)));
+        state.preheader = comp.setCursor(cursor);
+        random.used = true;
+    }
+    asmjit::x86::Gp counter = comp.newInt64("counter");
+    comp.lea(counter, asmjit::x86::ptr(random.first_row, random.row, 0, random.offset));
+    asmjit::x86::Xmm x0 = comp.newXmm("x0");
+    comp.movq(x0, counter);
+    if (state.packed)
+    {
+        comp.inc(counter);
+        asmjit::x86::Xmm next = comp.newXmm();
+        comp.movq(next, counter);
+        comp.punpcklqdq(x0, next);
+    }
+    // The high halves of the row counters go into the second word, as in random_mantissa()
+    asmjit::x86::Xmm x1 = comp.newXmm("x1");
+    comp.movdqa(x1, x0);
+    comp.psrlq(x1, 32);
+    comp.pxor(x1, random.stream_word);
+    asmjit::x86::Xmm site = comp.newXmm();
+    load_bits(comp, state, site, site_word(m_site));
+    comp.pxor(x1, site);
+
+    asmjit::x86::Xmm multiplier = comp.newXmm();
+    load_bits(comp, state, multiplier, PHILOX_MULTIPLIER);
+    asmjit::x86::Xmm low_half = comp.newXmm();
+    load_bits(comp, state, low_half, 0xFFFFFFFF);
+    for (int round = 0; round < PHILOX_ROUNDS; ++round)
+    {
+        asmjit::x86::Xmm product = comp.newXmm();
+        comp.movdqa(product, x0);
+        comp.pmuludq(product, multiplier);
+        asmjit::x86::Xmm high = comp.newXmm();
+        comp.movdqa(high, product);
+        comp.psrlq(high, 32);
+        const auto key = static_cast<std::int32_t>(offsetof(RandomState, keys) + round * sizeof(RandomState::keys[0]));
+        comp.pxor(high, asmjit::x86::xmmword_ptr(random.address, key));
+        comp.pxor(high, x1);
+        comp.pand(product, low_half);
+        x0 = high;
+        x1 = product;
+    }
+
+    // 32 bits of x0 and 20 of x1 as the mantissa of a double in [1, 2)
+    comp.psllq(x0, 20);
+    comp.psrlq(x1, 12);
+    comp.por(x0, x1);
+    asmjit::x86::Xmm offset = comp.newXmm();
+    load_constant(comp, state, offset, 1.0);
+    comp.por(x0, offset);
+    if (!m_normal)
+    {
+        emit_arithmetic(comp, state, '-', x0, offset);
+        comp.movapd(result, x0);
+        return true;
+    }
+    load_constant(comp, state, offset, OPEN_INTERVAL_OFFSET);
+    emit_arithmetic(comp, state, '-', x0, offset);
+    PackedMath(comp, state).inverse_normal(result, x0);
+    return true;
+}
+
+bool RandomNode::compile_gradient(
+    asmjit::x86::Compiler &, EmitterState &, asmjit::x86::Xmm, const TangentRegisters &) const
+{
+    std::cerr << "Gradients of random variables are not supported\n";
+    return false;
+}
+
+bool RandomNode::compile_integer(asmjit::x86::Compiler &, EmitterState &, asmjit::x86::Gp) const
+{
+    std::cerr << "Integer formulas don't support random variables\n";
+    return false;
+}
+
+bool CallNode::assemble(asmjit::x86::Assembler & /*assem*/, EmitterState & /*state*/) const
+{
+    std::cerr << "Function calls are not supported by the assembler; use compile\n";
+    return false;
+}
+
+bool CallNode::compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const
+{
+    if (state.complex)
+    {
+        std::cerr << "Complex formulas don't support function calls\n";
+        return false;
+    }
+    InlineCall call{result, {}, state.packed, state.single};
+    for (const std::shared_ptr<Node> &argument : m_arguments)
+    {
+        asmjit::x86::Xmm value = new_value_register(comp, state);
+        if (!argument->compile(comp, state, value))
+        {
+            return false;
+        }
+        call.arguments.push_back(value);
+    }
+    if (m_function->emit && m_function->emit(comp, call))
+    {
+        return true;
+    }
+
+    // Otherwise the native function computes each lane in double precision
+    const std::uint32_t lanes = !state.packed ? 1 : state.single ? 4 : 2;
+    std::vector<asmjit::x86::Xmm> values;
+    for (std::uint32_t lane = 0; lane < lanes; ++lane)
+    {
+        std::vector<asmjit::x86::Xmm> arguments;
+        for (asmjit::x86::Xmm argument : call.arguments)
+        {
+            arguments.push_back(lane_value(comp, state, argument, lane));
+        }
+        asmjit::InvokeNode *invoke;
+        comp.invoke(&invoke, asmjit::Imm(reinterpret_cast<std::uintptr_t>(m_function->native)),
+            native_signature(arguments.size()));
+        for (std::size_t i = 0; i < arguments.size(); ++i)
+        {
+            invoke->setArg(i, arguments[i]);
+        }
+        asmjit::x86::Xmm value = comp.newXmm();
+        invoke->setRet(0, value);
+        if (state.single)
+        {
+            comp.cvtsd2ss(value, value);
+        }
+        values.push_back(value);
+    }
+    if (lanes == 4)
+    {
+        comp.unpcklps(values[0], values[1]);
+        comp.unpcklps(values[2], values[3]);
+        comp.movlhps(values[0], values[2]);
+    }
+    else if (lanes == 2)
+    {
+        comp.unpcklpd(values[0], values[1]);
+    }
+    comp.movaps(result, values[0]);
+    return true;
+}
+
+bool CallNode::compile_gradient(
+    asmjit::x86::Compiler &, EmitterState &, asmjit::x86::Xmm, const TangentRegisters &) const
+{
+    std::cerr << "Gradients of function calls are not supported\n";
+    return false;
+}
+
+bool CallNode::compile_integer(asmjit::x86::Compiler &, EmitterState &, asmjit::x86::Gp) const
+{
+    std::cerr << "Integer formulas don't support function calls\n";
+    return false;
+}
+
+bool ProgramNode::assemble(asmjit::x86::Assembler & /*assem*/, EmitterState & /*state*/) const
+{
+    std::cerr << "Assignments are not supported by the assembler; use compile\n";
+    return false;
+}
+
+bool ProgramNode::compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const
+{
+    // Assigned variables live in registers; later references to them read the register
+    // instead of the data section.  The final registers are left in state.registers.
+    for (const Statement &statement : m_statements)
+    {
+        asmjit::x86::Xmm value = &statement == &m_statements.back() ? result : new_value_register(comp, state);
+        if (!statement.value->compile(comp, state, value))
+        {
+            return false;
+        }
+        if (!statement.name.empty())
+        {
+            state.registers[statement.name] = value;
+        }
+    }
+    return true;
+}
+
+bool ProgramNode::compile_gradient(
+    asmjit::x86::Compiler &, EmitterState &, asmjit::x86::Xmm, const TangentRegisters &) const
+{
+    std::cerr << "Gradients of multi-statement formulas are not supported\n";
+    return false;
+}
+
+bool ProgramNode::compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const
+{
+    for (const Statement &statement : m_statements)
+    {
+        asmjit::x86::Gp value = &statement == &m_statements.back() ? result : comp.newInt64();
+        if (!statement.value->compile_integer(comp, state, value))
+        {
+            return false;
+        }
+        if (!statement.name.empty())
+        {
+            state.integer_registers[statement.name] = value;
+        }
+    }
+    return true;
+}
+
+} // namespace internal
+
+} // namespace formula
@@ -0,0 +1,150 @@
+#include "parsed_formula.h"
+
+namespace formula
+{
+
+namespace internal
+{
+
+ComplexSymbols ParsedFormula::complex_symbols() const
+{
+    ComplexSymbols symbols{{"i", Complex{0.0, 1.0}}};
+    for (const auto &[name, value] : m_state.symbols)
+    {
+        symbols[name] = value;
+    }
+    for (const auto &[name, value] : m_complex_values)
+    {
+        symbols[name] = value;
+    }
+    return symbols;
+}
+
+bool ParsedFormula::evaluate_complex(Complex &result)
+{
+    if (m_complex_function)
+    {
+        m_complex_function(&result);
+        return true;
+    }
+
+    return m_ast->evaluate_complex(complex_symbols(), result);
+}
+
+bool ParsedFormula::evaluate_complex_batch(const Complex *const *columns, Complex *results, std::size_t count)
+{
+    if (m_complex_batch_function)
+    {
+        m_complex_batch_function(columns, results, count);
+        return true;
+    }
+
+    ComplexSymbols symbols{complex_symbols()};
+    std::vector<Complex *> slots;
+    for (const std::string &name : m_batch_variables)
+    {
+        slots.push_back(&symbols[name]);
+    }
+    for (std::size_t row = 0; row < count; ++row)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            *slots[i] = columns[i][row];
+        }
+        if (!m_ast->evaluate_complex(symbols, results[row]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ParsedFormula::compile_complex()
+{
+    m_complex_function = nullptr;
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    m_state.complex = complex_symbols();
+    asmjit::x86::Compiler comp(&code);
+    asmjit::FuncNode *func = comp.addFunc(asmjit::FuncSignature::build<void, Complex *>());
+    asmjit::x86::Gp output = comp.newIntPtr("output");
+    func->setArg(0, output);
+    m_state.preheader = comp.cursor();
+    asmjit::x86::Xmm result = new_value_register(comp, m_state);
+    if (!m_ast->compile(comp, m_state, result))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    comp.movupd(asmjit::x86::xmmword_ptr(output), result);
+    comp.ret();
+    comp.endFunc();
+    emit_data_section(comp, m_state);
+    comp.finalize();
+
+    if (const asmjit::Error err = add_function(m_complex_function, code); err || !m_complex_function)
+    {
+        std::cerr << "Failed to compile complex formula: " << asmjit::DebugUtils::errorAsString(err) << '\n';
+        return false;
+    }
+    return true;
+}
+
+// One point per register: a complex value fills the 16 bytes of an xmm register.
+bool ParsedFormula::compile_complex_batch()
+{
+    m_complex_batch_function = nullptr;
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    m_state.complex = complex_symbols();
+    asmjit::x86::Compiler comp(&code);
+    asmjit::x86::Gp columns;
+    asmjit::x86::Gp results;
+    asmjit::x86::Gp count;
+    begin_function(comp, asmjit::FuncSignature::build<void, const Complex *const *, Complex *, std::size_t>(),
+        {{&columns, "columns"}, {&results, "results"}, {&count, "count"}});
+
+    const std::vector<bool> reads = read_columns();
+    const std::vector<asmjit::x86::Gp> bases = load_bases(comp, columns, reads);
+    asmjit::x86::Gp row = comp.newIntPtr("row");
+    // Byte offset of the row, since the 16 byte stride exceeds the largest index scale
+    asmjit::x86::Gp offset = comp.newIntPtr("offset");
+    m_state.preheader = comp.cursor();
+
+    const auto emit_row = [&]
+    {
+        comp.mov(offset, row);
+        comp.shl(offset, 4);
+        bind_inputs(m_state.registers, reads,
+            [&](size_t column)
+            {
+                asmjit::x86::Xmm input = comp.newXmmPd();
+                comp.movupd(input, asmjit::x86::xmmword_ptr(bases[column], offset));
+                return input;
+            });
+        asmjit::x86::Xmm value = new_value_register(comp, m_state);
+        if (!m_ast->compile(comp, m_state, value))
+        {
+            return false;
+        }
+        comp.movupd(asmjit::x86::xmmword_ptr(results, offset), value);
+        return true;
+    };
+    if (!emit_row_loop(comp, row, count, 1, comp.newLabel(), emit_row))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    comp.ret();
+    return finish_function(comp, code, m_complex_batch_function, "complex batch formula");
+}
+
+} // namespace internal
+
+} // namespace formula
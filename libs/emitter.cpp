@@ -0,0 +1,544 @@
+#include "emitter.h"
+
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace formula
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Unsigned 128 bit intermediates of fixed point arithmetic, without relying on __int128.
+struct Wide
+{
+    std::uint64_t high;
+    std::uint64_t low;
+};
+
+Wide multiply_wide(std::uint64_t left, std::uint64_t right)
+{
+    constexpr std::uint64_t half = 0xFFFFFFFF;
+    const std::uint64_t low = (left & half) * (right & half);
+    const std::uint64_t cross1 = (left & half) * (right >> 32);
+    const std::uint64_t cross2 = (left >> 32) * (right & half);
+    const std::uint64_t middle = (low >> 32) + (cross1 & half) + (cross2 & half);
+    return {(left >> 32) * (right >> 32) + (cross1 >> 32) + (cross2 >> 32) + (middle >> 32),
+        middle << 32 | (low & half)};
+}
+
+// high:low / divisor for high < divisor, like the div instruction.
+std::uint64_t divide_wide(std::uint64_t high, std::uint64_t low, std::uint64_t divisor)
+{
+    for (int i = 0; i < 64; ++i)
+    {
+        const bool carry = high >> 63 != 0;
+        high = high << 1 | low >> 63;
+        low <<= 1;
+        if (carry || high >= divisor)
+        {
+            high -= divisor;
+            low |= 1;
+        }
+    }
+    return low;
+}
+
+// Process wide storage for the constants of compiled code, shared by all formulas.  Each
+// slot holds a value replicated over 16 bytes so a single aligned load broadcasts it.
+// Slots are never freed, which keeps the addresses valid for every compiled function.
+class ConstantPool
+{
+public:
+    static ConstantPool &instance()
+    {
+        static ConstantPool pool;
+        return pool;
+    }
+
+    const void *slot(std::uint64_t pattern);
+
+private:
+    struct alignas(16) Slot
+    {
+        std::uint64_t halves[2];
+    };
+    static constexpr std::size_t BLOCK_SLOTS{256};
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<Slot[]>> m_blocks;
+    std::size_t m_used{BLOCK_SLOTS};
+    std::unordered_map<std::uint64_t, const Slot *> m_slots;
+};
+
+const void *ConstantPool::slot(std::uint64_t pattern)
+{
+    std::lock_guard lock(m_mutex);
+    if (const auto it = m_slots.find(pattern); it != m_slots.end())
+    {
+        return it->second;
+    }
+    if (m_used == BLOCK_SLOTS)
+    {
+        m_blocks.emplace_back(new Slot[BLOCK_SLOTS]);
+        m_used = 0;
+    }
+    Slot &slot = m_blocks.back()[m_used++];
+    slot.halves[0] = pattern;
+    slot.halves[1] = pattern;
+    m_slots[pattern] = &slot;
+    return &slot;
+}
+
+// Complex products and quotients of complex_arithmetic() on [re, im] registers; [a*c, b*c] is
+// added to [-b*d, a*d], where a quotient takes the conjugate's -d.  The low lane is negated by
+// xorpd with the complex constant -0.0, whose high lane is zero, so no SSE3 addsubpd is needed.
+void emit_complex_product(
+    asmjit::x86::Compiler &comp, EmitterState &state, char op, asmjit::x86::Xmm result, asmjit::x86::Xmm operand)
+{
+    asmjit::x86::Xmm real = comp.newXmmPd("real");
+    comp.movapd(real, operand);
+    comp.unpcklpd(real, real); // [c, c]
+    asmjit::x86::Xmm imag = comp.newXmmPd("imag");
+    if (op == '/')
+    {
+        comp.xorpd(imag, imag);
+        comp.subpd(imag, operand);
+        comp.unpckhpd(imag, imag); // [-d, -d]
+    }
+    else
+    {
+        comp.movapd(imag, operand);
+        comp.unpckhpd(imag, imag); // [d, d]
+    }
+    asmjit::x86::Xmm swapped = comp.newXmmPd("swapped");
+    comp.movapd(swapped, result);
+    comp.shufpd(swapped, swapped, 1); // [b, a]
+    comp.mulpd(result, real);
+    comp.mulpd(swapped, imag);
+    asmjit::x86::Xmm sign = comp.newXmmPd("sign");
+    load_bits(comp, state, sign, constant_bits(state, -0.0)); // [-0.0, 0.0]
+    comp.xorpd(swapped, sign);
+    comp.addpd(result, swapped);
+    if (op == '/')
+    {
+        asmjit::x86::Xmm norm = comp.newXmmPd("norm");
+        comp.movapd(norm, operand);
+        comp.mulpd(norm, operand); // [c*c, d*d]
+        asmjit::x86::Xmm sum = comp.newXmmPd();
+        comp.movapd(sum, norm);
+        comp.shufpd(sum, sum, 1);
+        comp.addpd(norm, sum);
+        comp.divpd(result, norm);
+    }
+}
+
+} // namespace
+
+std::int64_t to_fixed(double value, unsigned fraction_bits)
+{
+    return std::llround(std::ldexp(value, static_cast<int>(fraction_bits)));
+}
+
+bool integer_arithmetic(
+    const IntegerFormat &format, char op, std::int64_t left, std::int64_t right, std::int64_t &result)
+{
+    // Wrapping arithmetic is done unsigned to avoid undefined behavior
+    const auto wrap = [](std::uint64_t value) { return static_cast<std::int64_t>(value); };
+    const auto bits = [](std::int64_t value) { return static_cast<std::uint64_t>(value); };
+    constexpr std::int64_t max = std::numeric_limits<std::int64_t>::max();
+    if (op == '+')
+    {
+        result = wrap(bits(left) + bits(right));
+        return !format.checked || ((left ^ result) & (right ^ result)) >= 0;
+    }
+    if (op == '-')
+    {
+        result = wrap(bits(left) - bits(right));
+        return !format.checked || ((left ^ right) & (left ^ result)) >= 0;
+    }
+    if (op == '*')
+    {
+        Wide product = multiply_wide(bits(left), bits(right));
+        product.high -= (left < 0 ? bits(right) : 0) + (right < 0 ? bits(left) : 0);
+        std::int64_t high = wrap(product.high);
+        result = wrap(product.low);
+        if (format.fraction_bits)
+        {
+            result = wrap(product.low >> format.fraction_bits | product.high << (64 - format.fraction_bits));
+            high >>= format.fraction_bits;
+        }
+        return !format.checked || high == result >> 63;
+    }
+    if (op == '/')
+    {
+        if (right == 0)
+        {
+            return false;
+        }
+        // Magnitudes divided in two steps, so that the quotient can't overflow the division
+        const bool negative = (left < 0) != (right < 0);
+        const std::uint64_t magnitude = left < 0 ? 0 - bits(left) : bits(left);
+        const std::uint64_t divisor = right < 0 ? 0 - bits(right) : bits(right);
+        const std::uint64_t high = format.fraction_bits ? magnitude >> (64 - format.fraction_bits) : 0;
+        const std::uint64_t quotient = divide_wide(high % divisor, magnitude << format.fraction_bits, divisor);
+        result = wrap(negative ? 0 - quotient : quotient);
+        return !format.checked || (high / divisor == 0 && quotient <= bits(max) + negative);
+    }
+    throw std::runtime_error(std::string{"Invalid binary operator '"} + op + "'");
+}
+
+Complex complex_arithmetic(char op, Complex left, Complex right)
+{
+    const double a = left.real();
+    const double b = left.imag();
+    const double c = right.real();
+    const double d = right.imag();
+    if (op == '+')
+    {
+        return {a + c, b + d};
+    }
+    if (op == '-')
+    {
+        return {a - c, b - d};
+    }
+    if (op == '*')
+    {
+        return {a * c - b * d, b * c + a * d};
+    }
+    if (op == '/')
+    {
+        const double norm = c * c + d * d;
+        return {(a * c + b * d) / norm, (b * c - a * d) / norm};
+    }
+    throw std::runtime_error(std::string{"Invalid binary operator '"} + op + "'");
+}
+
+std::uint64_t constant_bits(const EmitterState &state, double value)
+{
+    if (state.single)
+    {
+        const float narrow = static_cast<float>(value);
+        std::uint32_t bits;
+        std::memcpy(&bits, &narrow, sizeof(bits));
+        return static_cast<std::uint64_t>(bits) << 32 | bits;
+    }
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+asmjit::x86::Xmm new_value_register(asmjit::x86::Compiler &comp, const EmitterState &state)
+{
+    if (state.complex)
+    {
+        return comp.newXmmPd();
+    }
+    if (state.single)
+    {
+        return state.packed ? comp.newXmmPs() : comp.newXmmSs();
+    }
+    return state.packed ? comp.newXmmPd() : comp.newXmmSd();
+}
+
+void load_value(asmjit::x86::Compiler &comp, const EmitterState &state, asmjit::x86::Xmm result, asmjit::Label label)
+{
+    if (state.complex)
+    {
+        comp.movupd(result, asmjit::x86::ptr(label));
+        return;
+    }
+    if (state.single)
+    {
+        comp.movss(result, asmjit::x86::ptr(label));
+        comp.shufps(result, result, 0); // Broadcast to all lanes
+        return;
+    }
+    comp.movq(result, asmjit::x86::ptr(label));
+    comp.unpcklpd(result, result); // Broadcast to both lanes
+}
+
+void load_bits(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result, std::uint64_t bits)
+{
+    if (bits == 0)
+    {
+        comp.xorps(result, result);
+        return;
+    }
+    load_invariant(comp, state, state.constant_registers, bits, result,
+        [&](asmjit::x86::Xmm constant)
+        {
+            if (bits == constant_bits(state, 1.0) || bits == constant_bits(state, -1.0) ||
+                bits == constant_bits(state, 0.5))
+            {
+                asmjit::x86::Gp immediate = comp.newInt64("immediate");
+                comp.mov(immediate, bits);
+                comp.movq(constant, immediate);
+                if (!state.complex)
+                {
+                    comp.unpcklpd(constant, constant); // Broadcast; single precision bits are already paired
+                }
+                return;
+            }
+            asmjit::x86::Gp address = comp.newIntPtr("constant");
+            comp.mov(address, reinterpret_cast<std::uintptr_t>(ConstantPool::instance().slot(bits)));
+            if (state.complex)
+            {
+                comp.movq(constant, asmjit::x86::ptr(address));
+            }
+            else
+            {
+                comp.movaps(constant, asmjit::x86::ptr(address));
+            }
+        });
+}
+
+void load_constant(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result, double value)
+{
+    load_bits(comp, state, result, constant_bits(state, value));
+}
+
+asmjit::InstId sse_inst(
+    const EmitterState &state, asmjit::InstId sd, asmjit::InstId pd, asmjit::InstId ss, asmjit::InstId ps)
+{
+    if (state.single)
+    {
+        return state.packed ? ps : ss;
+    }
+    return state.packed || state.complex ? pd : sd;
+}
+
+bool emit_arithmetic(
+    asmjit::x86::Compiler &comp, EmitterState &state, char op, asmjit::x86::Xmm result, asmjit::x86::Xmm operand)
+{
+    using Inst = asmjit::x86::Inst;
+    if (state.complex && (op == '*' || op == '/'))
+    {
+        emit_complex_product(comp, state, op, result, operand);
+        return true;
+    }
+    if (op == '+')
+    {
+        comp.emit(sse_inst(state, Inst::kIdAddsd, Inst::kIdAddpd, Inst::kIdAddss, Inst::kIdAddps), result, operand);
+        return true;
+    }
+    if (op == '-')
+    {
+        comp.emit(sse_inst(state, Inst::kIdSubsd, Inst::kIdSubpd, Inst::kIdSubss, Inst::kIdSubps), result, operand);
+        return true;
+    }
+    if (op == '*')
+    {
+        comp.emit(sse_inst(state, Inst::kIdMulsd, Inst::kIdMulpd, Inst::kIdMulss, Inst::kIdMulps), result, operand);
+        return true;
+    }
+    if (op == '/')
+    {
+        comp.emit(sse_inst(state, Inst::kIdDivsd, Inst::kIdDivpd, Inst::kIdDivss, Inst::kIdDivps), result, operand);
+        return true;
+    }
+    return false;
+}
+
+bool emit_integer_arithmetic(
+    asmjit::x86::Compiler &comp, const EmitterState &state, char op, asmjit::x86::Gp result, asmjit::x86::Gp operand)
+{
+    const IntegerFormat &format = *state.integer;
+    const auto check_overflow = [&]
+    {
+        if (format.checked)
+        {
+            comp.jo(state.overflow);
+        }
+    };
+    if (op == '+')
+    {
+        comp.add(result, operand);
+        check_overflow();
+        return true;
+    }
+    if (op == '-')
+    {
+        comp.sub(result, operand);
+        check_overflow();
+        return true;
+    }
+    if (op == '*')
+    {
+        // high:result holds the 128 bit product, rescaled with shrd
+        asmjit::x86::Gp high = comp.newInt64("high");
+        comp.imul(high, result, operand);
+        if (format.fraction_bits)
+        {
+            comp.shrd(result, high, format.fraction_bits);
+            comp.sar(high, format.fraction_bits);
+        }
+        if (format.checked)
+        {
+            asmjit::x86::Gp sign = comp.newInt64("sign");
+            comp.mov(sign, result);
+            comp.sar(sign, 63);
+            comp.cmp(sign, high);
+            comp.jne(state.overflow);
+        }
+        return true;
+    }
+    if (op == '/')
+    {
+        comp.test(operand, operand);
+        comp.jz(state.overflow);
+        // Unsigned division of the magnitudes in two steps, as in integer_arithmetic(); a single
+        // idiv of the 128 bit dividend faults when the quotient doesn't fit
+        const auto magnitude = [&](asmjit::x86::Gp value, const char *name)
+        {
+            asmjit::x86::Gp absolute = comp.newInt64(name);
+            asmjit::x86::Gp mask = comp.newInt64("mask");
+            comp.mov(absolute, value);
+            comp.mov(mask, value);
+            comp.sar(mask, 63);
+            comp.xor_(absolute, mask);
+            comp.sub(absolute, mask);
+            return absolute;
+        };
+        asmjit::x86::Gp negative = comp.newInt64("negative");
+        comp.mov(negative, result);
+        comp.xor_(negative, operand);
+        comp.sar(negative, 63);
+        asmjit::x86::Gp low = magnitude(result, "low");
+        asmjit::x86::Gp divisor = magnitude(operand, "divisor");
+        asmjit::x86::Gp high = comp.newInt64("high");
+        asmjit::x86::Gp remainder = comp.newInt64("remainder");
+        comp.xor_(remainder, remainder);
+        if (format.fraction_bits)
+        {
+            comp.mov(high, low);
+            comp.shr(high, 64 - format.fraction_bits);
+            comp.shl(low, format.fraction_bits);
+        }
+        else
+        {
+            comp.xor_(high, high);
+        }
+        comp.div(remainder, high, divisor);
+        comp.div(remainder, low, divisor);
+        if (format.checked)
+        {
+            // The magnitude may reach 2^63 for negative quotients
+            comp.test(high, high);
+            comp.jnz(state.overflow);
+            asmjit::x86::Gp limit = comp.newInt64("limit");
+            comp.mov(limit, std::numeric_limits<std::int64_t>::max());
+            comp.sub(limit, negative);
+            comp.cmp(low, limit);
+            comp.ja(state.overflow);
+        }
+        comp.xor_(low, negative);
+        comp.sub(low, negative);
+        comp.mov(result, low);
+        return true;
+    }
+    return false;
+}
+
+double chain_power(double base, const ChainExponent &exponent)
+{
+    if (exponent.value == 0)
+    {
+        return 1.0;
+    }
+    const double power = detail::chain_power(base, exponent.chain);
+    return exponent.value < 0 ? 1.0 / power : power;
+}
+
+bool integer_power(const IntegerFormat &format, std::int64_t base, const ChainExponent &exponent, std::int64_t &result)
+{
+    const std::int64_t one = to_fixed(1.0, format.fraction_bits);
+    if (exponent.value == 0)
+    {
+        result = one;
+        return true;
+    }
+    const detail::AdditionChain &chain = exponent.chain;
+    std::array<std::int64_t, detail::MAX_CHAIN_LENGTH> powers{base};
+    for (std::size_t i = 1; i < chain.length; ++i)
+    {
+        if (!integer_arithmetic(format, '*', powers[i - 1], powers[chain.operands[i]], powers[i]))
+        {
+            return false;
+        }
+    }
+    if (exponent.value < 0)
+    {
+        return integer_arithmetic(format, '/', one, powers[chain.length - 1], result);
+    }
+    result = powers[chain.length - 1];
+    return true;
+}
+
+Complex complex_power(Complex base, const ChainExponent &exponent)
+{
+    if (exponent.value == 0)
+    {
+        return 1.0;
+    }
+    const detail::AdditionChain &chain = exponent.chain;
+    std::array<Complex, detail::MAX_CHAIN_LENGTH> powers{base};
+    for (std::size_t i = 1; i < chain.length; ++i)
+    {
+        powers[i] = complex_arithmetic('*', powers[i - 1], powers[chain.operands[i]]);
+    }
+    return exponent.value < 0 ? complex_arithmetic('/', 1.0, powers[chain.length - 1]) : powers[chain.length - 1];
+}
+
+void emit_integer_power(
+    asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm value, const ChainExponent &exponent)
+{
+    if (exponent.value == 0)
+    {
+        load_constant(comp, state, value, 1.0);
+        return;
+    }
+    const detail::AdditionChain &chain = exponent.chain;
+    std::vector<asmjit::x86::Xmm> powers{value};
+    for (std::size_t i = 1; i < chain.length; ++i)
+    {
+        asmjit::x86::Xmm power = new_value_register(comp, state);
+        comp.movaps(power, powers.back());
+        emit_arithmetic(comp, state, '*', power, powers[chain.operands[i]]);
+        powers.push_back(power);
+    }
+    if (exponent.value < 0)
+    {
+        asmjit::x86::Xmm reciprocal = new_value_register(comp, state);
+        load_constant(comp, state, reciprocal, 1.0);
+        emit_arithmetic(comp, state, '/', reciprocal, powers.back());
+        comp.movaps(value, reciprocal);
+    }
+    else if (chain.length > 1)
+    {
+        comp.movaps(value, powers.back());
+    }
+}
+
+void emit_select(asmjit::x86::Compiler &comp, asmjit::x86::Xmm result, asmjit::x86::Xmm mask, asmjit::x86::Xmm value)
+{
+    asmjit::x86::Xmm kept = comp.newXmm();
+    comp.movaps(kept, mask);
+    comp.andnps(kept, result);
+    asmjit::x86::Xmm chosen = comp.newXmm();
+    comp.movaps(chosen, mask);
+    comp.andps(chosen, value);
+    comp.orps(kept, chosen);
+    comp.movaps(result, kept);
+}
+
+} // namespace internal
+
+} // namespace formula
@@ -0,0 +1,254 @@
+#pragma once
+
+#include "formula/formula.h"
+#include "formula/static_formula.h"
+
+#include <asmjit/core.h>
+#include <asmjit/x86.h>
+
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace formula
+{
+
+namespace internal
+{
+
+using SymbolTable = std::map<std::string, double>;
+using ConstantLabels = std::map<double, asmjit::Label>;
+using SymbolLabels = std::map<std::string, asmjit::Label>;
+using SymbolRegisters = std::map<std::string, asmjit::x86::Xmm>;
+using Variables = std::vector<std::string>;
+using VariableSet = std::set<std::string>;
+using TangentRegisters = std::vector<asmjit::x86::Xmm>;
+using IntegerSymbols = std::map<std::string, std::int64_t>;
+using IntegerRegisters = std::map<std::string, asmjit::x86::Gp>;
+using ConstantRegisters = std::map<std::uint64_t, asmjit::x86::Xmm>; // Keyed by bit pattern
+using Complex = std::complex<double>;
+using ComplexSymbols = std::map<std::string, Complex>;
+
+struct DataSection
+{
+    asmjit::Section *data{};  // Section for data storage
+    ConstantLabels constants; // Map of constants to labels
+    SymbolLabels symbols;     // Map of symbols to labels
+};
+
+// Seed, stream and row counter of the random variables, read by compiled code through its
+// address.  Round keys and the stream word are zero extended into both 64 bit lanes.
+struct alignas(16) RandomState
+{
+    std::uint64_t row{}; // Counter of the first row of the next batch
+    std::uint32_t seed{};
+    std::uint32_t stream{};
+    std::array<std::uint64_t, 2> stream_word{};
+    std::array<std::array<std::uint64_t, 2>, 10> keys{};
+};
+
+// Where the random variables of a batch kernel find their generator state and row.
+struct RandomRegisters
+{
+    const RandomState *state{};
+    asmjit::x86::Gp row;   // Row of the loop
+    std::int32_t offset{}; // Of the current unrolled step from row
+    bool used{};           // Set by the random variables; the kernel then advances the row counter
+    // Loaded at the preheader by the first random variable
+    asmjit::x86::Gp address{};   // Of the RandomState
+    asmjit::x86::Gp first_row{}; // Counter of the kernel's row 0
+    asmjit::x86::Xmm stream_word{};
+};
+
+struct EmitterState
+{
+    SymbolTable symbols;
+    DataSection data;
+    SymbolRegisters registers;             // Symbols held in registers instead of the data section
+    Variables variables;                   // Variables of differentiation
+    bool packed{};                         // Evaluate several rows at once, one per lane
+    bool single{};                         // Single precision arithmetic and data
+    std::optional<IntegerFormat> integer;  // Fixed point arithmetic and data in general purpose registers
+    IntegerRegisters integer_registers;    // Symbols held in registers by integer formulas
+    asmjit::Label overflow;                // Target of failed integer checks
+    std::optional<ComplexSymbols> complex; // [re, im] pairs in one register, with the symbol values
+    asmjit::BaseNode *preheader{};         // Where loop invariant values are materialized
+    ConstantRegisters constant_registers;  // Constants materialized at the preheader
+    SymbolRegisters symbol_registers;      // Data section symbols loaded at the preheader
+    std::optional<RandomRegisters> random; // Row counters of batch and reduction kernels
+};
+
+std::int64_t to_fixed(double value, unsigned fraction_bits);
+
+// Integer arithmetic with the same results as the compiled code; false on a failed
+// overflow check or division by zero.  Products and scaled dividends are exact 128 bit
+// values, so only a result outside the int64 range overflows.
+bool integer_arithmetic(
+    const IntegerFormat &format, char op, std::int64_t left, std::int64_t right, std::int64_t &result);
+
+// Complex arithmetic with the same results as the compiled code: textbook products and
+// quotients, without the scaling and infinity recovery of std::complex.
+Complex complex_arithmetic(char op, Complex left, Complex right);
+
+template <typename Emitter>
+asmjit::Label get_constant_label(Emitter &emitter, ConstantLabels &labels, double value)
+{
+    if (const auto it = labels.find(value); it != labels.end())
+    {
+        return it->second;
+    }
+
+    // Create a new label for the constant
+    asmjit::Label label = emitter.newLabel();
+    labels[value] = label;
+    return label;
+}
+
+template <typename Emitter>
+asmjit::Label get_symbol_label(Emitter &emitter, SymbolLabels &labels, std::string name)
+{
+    if (const auto it = labels.find(name); it != labels.end())
+    {
+        return it->second;
+    }
+
+    // Create a new label for the symbol
+    asmjit::Label label = emitter.newNamedLabel(name.c_str());
+    labels[name] = label;
+    return label;
+}
+
+template <typename Emitter>
+void embed_value(Emitter &emitter, const EmitterState &state, double value)
+{
+    if (state.integer)
+    {
+        emitter.embedInt64(to_fixed(value, state.integer->fraction_bits));
+    }
+    else if (state.single)
+    {
+        emitter.embedFloat(static_cast<float>(value));
+    }
+    else
+    {
+        emitter.embedDouble(value);
+    }
+}
+
+template <typename Emitter>
+void emit_data_section(Emitter &emitter, EmitterState &state)
+{
+    emitter.section(state.data.data);
+    for (const auto &[name, label] : state.data.symbols)
+    {
+        emitter.bind(label);
+        if (state.complex)
+        {
+            if (const auto it = state.complex->find(name); it != state.complex->end())
+            {
+                emitter.embedDouble(it->second.real());
+                emitter.embedDouble(it->second.imag());
+                continue;
+            }
+        }
+        else if (const auto it = state.symbols.find(name); it != state.symbols.end())
+        {
+            embed_value(emitter, state, it->second); // Embed the symbol value in the data section
+            continue;
+        }
+        throw std::runtime_error("Symbol not found: " + name);
+    }
+    for (const auto &[value, label] : state.data.constants)
+    {
+        emitter.bind(label);
+        embed_value(emitter, state, value); // Embed the constant value in the data section
+    }
+}
+
+// Bits of a constant as it is stored in a register; single precision values are
+// replicated into both halves.
+std::uint64_t constant_bits(const EmitterState &state, double value);
+
+asmjit::x86::Xmm new_value_register(asmjit::x86::Compiler &comp, const EmitterState &state);
+
+// Real values fill every lane, like constants, since the register is cached for all the loops
+// of the kernel.
+void load_value(asmjit::x86::Compiler &comp, const EmitterState &state, asmjit::x86::Xmm result, asmjit::Label label);
+
+// Emits a loop invariant value once at state.preheader and copies it into result.
+template <typename Key, typename Materialize>
+void load_invariant(asmjit::x86::Compiler &comp, EmitterState &state, std::map<Key, asmjit::x86::Xmm> &registers,
+    const Key &key, asmjit::x86::Xmm result, Materialize materialize)
+{
+    auto it = registers.find(key);
+    if (it == registers.end())
+    {
+        asmjit::BaseNode *cursor = comp.setCursor(state.preheader);
+        asmjit::x86::Xmm value = new_value_register(comp, state);
+        materialize(value);
+        state.preheader = comp.setCursor(cursor);
+        it = registers.emplace(key, value).first;
+    }
+    comp.movaps(result, it->second);
+}
+
+// Zero is materialized by xor and 1, -1 and 0.5 from immediates; other constants are
+// loaded from the shared pool.  Both fill every lane whether or not the code using them first
+// is packed, since the cached register also serves the other loops of the kernel.  Complex
+// constants are real, so only the low half is loaded.
+void load_bits(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result, std::uint64_t bits);
+
+void load_constant(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result, double value);
+
+// Selects the scalar or packed, double or single precision form of an SSE instruction.
+asmjit::InstId sse_inst(
+    const EmitterState &state, asmjit::InstId sd, asmjit::InstId pd, asmjit::InstId ss, asmjit::InstId ps);
+
+bool emit_arithmetic(
+    asmjit::x86::Compiler &comp, EmitterState &state, char op, asmjit::x86::Xmm result, asmjit::x86::Xmm operand);
+
+// Emits integer_arithmetic(); failed checks jump to state.overflow.
+bool emit_integer_arithmetic(
+    asmjit::x86::Compiler &comp, const EmitterState &state, char op, asmjit::x86::Gp result, asmjit::x86::Gp operand);
+
+// A constant integer exponent with the addition chain of its magnitude, looked up once per node.
+struct ChainExponent
+{
+    explicit ChainExponent(std::int64_t exponent) :
+        value(exponent),
+        chain(detail::addition_chain(static_cast<std::uint32_t>(std::abs(exponent))))
+    {
+    }
+
+    std::int64_t value;
+    detail::AdditionChain chain;
+};
+
+// base^exponent with the multiplications of detail::integer_power().
+double chain_power(double base, const ChainExponent &exponent);
+
+// Fixed point base^exponent along the addition chain of detail::integer_power(); false on
+// a failed check or division by zero.
+bool integer_power(const IntegerFormat &format, std::int64_t base, const ChainExponent &exponent, std::int64_t &result);
+
+// base^exponent along the addition chain of detail::integer_power() with the rounding of
+// the compiled code.
+Complex complex_power(Complex base, const ChainExponent &exponent);
+
+// Raises value to a constant power with the multiplications of detail::integer_power().
+void emit_integer_power(
+    asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm value, const ChainExponent &exponent);
+
+// Replaces the lanes of result where mask is set with the lanes of value.
+void emit_select(asmjit::x86::Compiler &comp, asmjit::x86::Xmm result, asmjit::x86::Xmm mask, asmjit::x86::Xmm value);
+
+} // namespace internal
+
+} // namespace formula
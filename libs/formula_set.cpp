@@ -0,0 +1,274 @@
+#include "parsed_formula.h"
+
+#include <atomic>
+#include <thread>
+
+namespace formula
+{
+
+namespace internal
+{
+
+namespace
+{
+
+// Each formula is evaluated as a batch of one row with the variables it reads as batch
+// variables, so compiled formulas pick up changed inputs without being recompiled.
+class ParsedFormulaSet : public FormulaSet
+{
+public:
+    bool define(std::string_view name, std::string_view text) override;
+    void set_value(std::string_view name, double value) override;
+    double get_value(std::string_view name) override;
+    void recalculate() override;
+    bool compile() override;
+    void set_threads(unsigned threads) override
+    {
+        m_threads = std::max(threads, 1U);
+    }
+    std::size_t evaluations() const override
+    {
+        return m_evaluations;
+    }
+
+private:
+    struct Cell
+    {
+        std::shared_ptr<ParsedFormula> formula;
+        Variables reads;
+        double value{};
+        bool dirty{true};
+    };
+
+    bool reaches(const std::string &from, const std::string &to) const;
+    void invalidate(const std::string &name);
+    void evaluate(Cell &cell);
+
+    std::map<std::string, Cell, std::less<>> m_cells;
+    std::map<std::string, double, std::less<>> m_values;
+    // Formulas reading each name
+    std::map<std::string, VariableSet, std::less<>> m_readers;
+    unsigned m_threads{1};
+    bool m_compiled{};
+    std::atomic<std::size_t> m_evaluations{};
+};
+
+bool ParsedFormulaSet::define(std::string_view name, std::string_view text)
+{
+    ParseError error;
+    std::shared_ptr<Formula> parsed = parse_fast(text, &error);
+    if (!parsed)
+    {
+        std::cerr << "Parse error in " << name << " at " << error.position << ": " << error.message << '\n';
+        return false;
+    }
+    auto formula = std::static_pointer_cast<ParsedFormula>(parsed);
+    const VariableSet reads = formula->variables();
+    const std::string key{name};
+    for (const std::string &read : reads)
+    {
+        if (reaches(read, key))
+        {
+            std::cerr << "Circular reference from " << key << " to " << read << '\n';
+            return false;
+        }
+    }
+    formula->set_log_file(nullptr);
+    formula->set_batch_variables(Variables(reads.begin(), reads.end()));
+    if (m_compiled && !formula->compile_batch())
+    {
+        return false;
+    }
+
+    if (const auto it = m_cells.find(key); it != m_cells.end())
+    {
+        for (const std::string &read : it->second.reads)
+        {
+            m_readers[read].erase(key);
+        }
+    }
+    for (const std::string &read : reads)
+    {
+        m_readers[read].insert(key);
+    }
+    m_cells[key] = Cell{std::move(formula), Variables(reads.begin(), reads.end())};
+    invalidate(key);
+    return true;
+}
+
+void ParsedFormulaSet::set_value(std::string_view name, double value)
+{
+    const std::string key{name};
+    m_values[key] = value;
+    invalidate(key);
+}
+
+double ParsedFormulaSet::get_value(std::string_view name)
+{
+    if (const auto it = m_cells.find(name); it != m_cells.end())
+    {
+        if (it->second.dirty)
+        {
+            recalculate();
+        }
+        return it->second.value;
+    }
+    const auto it = m_values.find(name);
+    return it != m_values.end() ? it->second : 0.0;
+}
+
+// Whether the formula named from reads to, directly or through other formulas.
+bool ParsedFormulaSet::reaches(const std::string &from, const std::string &to) const
+{
+    VariableSet visited;
+    std::vector<std::string> pending{from};
+    while (!pending.empty())
+    {
+        const std::string name = std::move(pending.back());
+        pending.pop_back();
+        if (name == to)
+        {
+            return true;
+        }
+        const auto it = m_cells.find(name);
+        if (it != m_cells.end() && visited.insert(name).second)
+        {
+            pending.insert(pending.end(), it->second.reads.begin(), it->second.reads.end());
+        }
+    }
+    return false;
+}
+
+// A dirty formula's readers are always dirty, so the walk stops at formulas already marked.
+void ParsedFormulaSet::invalidate(const std::string &name)
+{
+    const auto it = m_readers.find(name);
+    if (it == m_readers.end())
+    {
+        return;
+    }
+    for (const std::string &reader : it->second)
+    {
+        Cell &cell = m_cells.at(reader);
+        if (!cell.dirty)
+        {
+            cell.dirty = true;
+            invalidate(reader);
+        }
+    }
+}
+
+void ParsedFormulaSet::evaluate(Cell &cell)
+{
+    // Names that are neither formulas nor inputs keep the formula's own values, like pi
+    std::vector<double> inputs;
+    inputs.reserve(cell.reads.size());
+    for (const std::string &name : cell.reads)
+    {
+        if (const auto it = m_cells.find(name); it != m_cells.end())
+        {
+            inputs.push_back(it->second.value);
+        }
+        else if (const auto value = m_values.find(name); value != m_values.end())
+        {
+            inputs.push_back(value->second);
+        }
+        else
+        {
+            inputs.push_back(cell.formula->get_value(name));
+        }
+    }
+    std::vector<const double *> columns;
+    for (const double &input : inputs)
+    {
+        columns.push_back(&input);
+    }
+    cell.formula->evaluate_batch(columns.data(), &cell.value, 1);
+    cell.dirty = false;
+    ++m_evaluations;
+}
+
+// Dirty formulas are grouped into levels, one past the deepest dirty formula they read.  A
+// level only reads results of earlier levels, so its formulas are evaluated in parallel.
+// Each thread takes on at least this many formulas of a level; most recalculations after a
+// change reach a few formulas, which evaluate sooner than a thread starts.
+constexpr std::size_t MIN_CELLS_PER_THREAD{64};
+
+void ParsedFormulaSet::recalculate()
+{
+    std::map<std::string_view, std::size_t> levels;
+    std::function<std::size_t(const std::string &)> level = [&](const std::string &name)
+    {
+        if (const auto it = levels.find(name); it != levels.end())
+        {
+            return it->second;
+        }
+        std::size_t result{};
+        for (const std::string &read : m_cells.at(name).reads)
+        {
+            if (const auto it = m_cells.find(read); it != m_cells.end() && it->second.dirty)
+            {
+                result = std::max(result, level(read) + 1);
+            }
+        }
+        levels.emplace(name, result);
+        return result;
+    };
+    std::vector<std::vector<Cell *>> batches;
+    for (auto &[name, cell] : m_cells)
+    {
+        if (cell.dirty)
+        {
+            const std::size_t index = level(name);
+            batches.resize(std::max(batches.size(), index + 1));
+            batches[index].push_back(&cell);
+        }
+    }
+
+    for (const std::vector<Cell *> &batch : batches)
+    {
+        const auto evaluate_cells = [this, &batch](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+            {
+                evaluate(*batch[i]);
+            }
+        };
+        const std::size_t parts =
+            std::max<std::size_t>(1, std::min<std::size_t>(m_threads, batch.size() / MIN_CELLS_PER_THREAD));
+        std::vector<std::thread> workers;
+        for (std::size_t part = 1; part < parts; ++part)
+        {
+            workers.emplace_back(evaluate_cells, batch.size() * part / parts, batch.size() * (part + 1) / parts);
+        }
+        evaluate_cells(0, batch.size() / parts);
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+    }
+}
+
+bool ParsedFormulaSet::compile()
+{
+    m_compiled = true;
+    for (auto &[name, cell] : m_cells)
+    {
+        if (!cell.formula->compile_batch())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+} // namespace internal
+
+std::shared_ptr<FormulaSet> make_formula_set()
+{
+    return std::make_shared<internal::ParsedFormulaSet>();
+}
+
+} // namespace formula
@@ -0,0 +1,51 @@
+#include "functions.h"
+
+#include <algorithm>
+
+namespace formula
+{
+
+namespace internal
+{
+
+bool is_alpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+bool is_alnum(char c)
+{
+    return is_alpha(c) || (c >= '0' && c <= '9') || c == '_';
+}
+
+bool is_builtin_function(std::string_view name)
+{
+    return name == "rand" || name == "normal";
+}
+
+} // namespace internal
+
+namespace detail
+{
+
+bool register_function(std::string name, NativeFunction function, std::size_t arity, InlineEmitter emit)
+{
+    if (name.empty() || !internal::is_alpha(name.front()) ||
+        !std::all_of(name.begin(), name.end(), internal::is_alnum) || internal::is_builtin_function(name) ||
+        !function || arity > MAX_FUNCTION_ARGUMENTS)
+    {
+        return false;
+    }
+    internal::FunctionRegistry::instance().add(std::move(name),
+        std::make_shared<const internal::UserFunction>(internal::UserFunction{function, arity, std::move(emit)}));
+    return true;
+}
+
+bool register_function(std::string name, NativeFunction function, std::size_t arity)
+{
+    return register_function(std::move(name), function, arity, {});
+}
+
+} // namespace detail
+
+} // namespace formula
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "formula/function.h"
+#include "formula/inline_function.h"
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace formula
+{
+
+namespace internal
+{
+
+bool is_alpha(char c);
+
+bool is_alnum(char c);
+
+bool is_builtin_function(std::string_view name);
+
+struct UserFunction
+{
+    detail::NativeFunction native;
+    std::size_t arity;
+    InlineEmitter emit;
+};
+
+// Functions registered by the application; formulas keep the functions they were parsed with.
+class FunctionRegistry
+{
+public:
+    static FunctionRegistry &instance()
+    {
+        static FunctionRegistry *registry = new FunctionRegistry;
+        return *registry;
+    }
+
+    void add(std::string name, std::shared_ptr<const UserFunction> function)
+    {
+        std::lock_guard lock(m_mutex);
+        m_functions[std::move(name)] = std::move(function);
+    }
+    std::shared_ptr<const UserFunction> find(std::string_view name) const
+    {
+        std::lock_guard lock(m_mutex);
+        const auto it = m_functions.find(name);
+        return it != m_functions.end() ? it->second : nullptr;
+    }
+
+private:
+    mutable std::mutex m_mutex;
+    std::map<std::string, std::shared_ptr<const UserFunction>, std::less<>> m_functions;
+};
+
+} // namespace internal
+
+} // namespace formula
@@ -0,0 +1,83 @@
+#include "parsed_formula.h"
+
+#include <limits>
+
+namespace formula
+{
+
+namespace internal
+{
+
+double ParsedFormula::evaluate_gradient(const double *values, double *gradient)
+{
+    if (m_gradient_function)
+    {
+        return m_gradient_function(values, gradient);
+    }
+    if (rejects_random("evaluate_gradient"))
+    {
+        std::fill(gradient, gradient + m_gradient_variables.size(), std::numeric_limits<double>::quiet_NaN());
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    SymbolTable symbols{m_state.symbols};
+    for (size_t i = 0; i < m_gradient_variables.size(); ++i)
+    {
+        symbols[m_gradient_variables[i]] = values[i];
+    }
+    return m_ast->evaluate_gradient(symbols, m_gradient_variables, gradient);
+}
+
+bool ParsedFormula::compile_gradient()
+{
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    asmjit::x86::Compiler comp(&code);
+    asmjit::FuncNode *func = comp.addFunc(asmjit::FuncSignature::build<double, const double *, double *>());
+    asmjit::x86::Gp values = comp.newIntPtr("values");
+    asmjit::x86::Gp gradient = comp.newIntPtr("gradient");
+    func->setArg(0, values);
+    func->setArg(1, gradient);
+    m_state.preheader = comp.cursor();
+
+    // Variables of differentiation are loaded once into registers; every other
+    // identifier still comes from the data section.
+    m_state.variables = m_gradient_variables;
+    TangentRegisters tangents;
+    for (size_t i = 0; i < m_gradient_variables.size(); ++i)
+    {
+        asmjit::x86::Xmm value = comp.newXmmSd();
+        comp.movsd(value, asmjit::x86::qword_ptr(values, static_cast<int32_t>(i * sizeof(double))));
+        m_state.registers[m_gradient_variables[i]] = value;
+        tangents.push_back(comp.newXmmSd());
+    }
+    asmjit::x86::Xmm result = comp.newXmmSd();
+    if (!m_ast->compile_gradient(comp, m_state, result, tangents))
+    {
+        std::cerr << "Failed to compile AST gradient\n";
+        return false;
+    }
+    for (size_t i = 0; i < tangents.size(); ++i)
+    {
+        comp.movsd(asmjit::x86::qword_ptr(gradient, static_cast<int32_t>(i * sizeof(double))), tangents[i]);
+    }
+    comp.ret(result);
+    comp.endFunc();
+    emit_data_section(comp, m_state);
+    comp.finalize();
+
+    if (const asmjit::Error err = add_function(m_gradient_function, code); err || !m_gradient_function)
+    {
+        std::cerr << "Failed to compile formula gradient: " << asmjit::DebugUtils::errorAsString(err) << '\n';
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace internal
+
+} // namespace formula
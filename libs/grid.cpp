@@ -0,0 +1,275 @@
+#include "parsed_formula.h"
+
+#include <thread>
+
+namespace formula
+{
+
+namespace internal
+{
+
+// Evaluates the points whose index along the last axis is in [begin, end).
+void ParsedFormula::interpret_grid(const GridAxis *axes, double *results, std::size_t begin, std::size_t end) const
+{
+    SymbolTable symbols{m_state.symbols};
+    std::vector<double *> slots;
+    for (const std::string &name : m_grid_variables)
+    {
+        slots.push_back(&symbols[name]);
+    }
+    const std::size_t last = slots.size() - 1;
+    std::array<std::size_t, 3> index{};
+    std::array<std::size_t, 3> limit{};
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        limit[i] = axes[i].count;
+        if (limit[i] == 0)
+        {
+            return;
+        }
+    }
+    index[last] = begin;
+    limit[last] = end;
+    if (begin >= end)
+    {
+        return;
+    }
+    while (true)
+    {
+        std::size_t offset{index[0]};
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            *slots[i] = axes[i].start + static_cast<double>(index[i]) * axes[i].step;
+            offset += i > 0 ? index[i] * axes[i].stride : 0;
+        }
+        results[offset] = m_ast->evaluate(symbols);
+
+        std::size_t axis{};
+        while (++index[axis] == limit[axis])
+        {
+            if (axis == last)
+            {
+                return;
+            }
+            index[axis++] = 0;
+        }
+    }
+}
+
+// Each thread takes on at least this many points, so small grids don't pay for starting
+// threads that would take longer to start than to evaluate their share.
+constexpr std::size_t MIN_GRID_POINTS_PER_THREAD{16384};
+
+bool ParsedFormula::evaluate_grid(const GridAxis *axes, double *results, unsigned threads)
+{
+    if (m_grid_variables.empty() || m_grid_variables.size() > 3)
+    {
+        std::cerr << "Grids have one to three axes\n";
+        return false;
+    }
+    if (rejects_random("evaluate_grid"))
+    {
+        // Random variables interpret as NaN, stored wherever the strides place the points
+        interpret_grid(axes, results, 0, axes[m_grid_variables.size() - 1].count);
+        return false;
+    }
+    const auto evaluate_rows = [this, axes, results](std::size_t begin, std::size_t end)
+    {
+        if (m_grid_function)
+        {
+            m_grid_function(axes, results, begin, end);
+        }
+        else
+        {
+            interpret_grid(axes, results, begin, end);
+        }
+    };
+
+    const std::size_t rows = axes[m_grid_variables.size() - 1].count;
+    std::size_t points{1};
+    for (std::size_t axis = 0; axis < m_grid_variables.size(); ++axis)
+    {
+        points *= axes[axis].count;
+    }
+    const std::size_t parts =
+        std::max<std::size_t>(1, std::min<std::size_t>({threads, rows, points / MIN_GRID_POINTS_PER_THREAD}));
+    std::vector<std::thread> workers;
+    for (std::size_t part = 1; part < parts; ++part)
+    {
+        workers.emplace_back(evaluate_rows, rows * part / parts, rows * (part + 1) / parts);
+    }
+    evaluate_rows(0, rows / parts);
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    return true;
+}
+
+// The first axis runs two points per iteration from a vector of indices [i, i + 1]; the
+// coordinates of the other axes are computed once per row and broadcast.
+bool ParsedFormula::compile_grid()
+{
+    m_grid_function = nullptr;
+    const size_t dimensions = m_grid_variables.size();
+    if (dimensions == 0 || dimensions > 3)
+    {
+        std::cerr << "Grids have one to three axes\n";
+        return false;
+    }
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    asmjit::x86::Compiler comp(&code);
+    asmjit::FuncNode *func = comp.addFunc(
+        asmjit::FuncSignature::build<void, const GridAxis *, double *, std::size_t, std::size_t>());
+    asmjit::x86::Gp axes = comp.newIntPtr("axes");
+    asmjit::x86::Gp results = comp.newIntPtr("results");
+    asmjit::x86::Gp begin = comp.newIntPtr("begin");
+    asmjit::x86::Gp end = comp.newIntPtr("end");
+    func->setArg(0, axes);
+    func->setArg(1, results);
+    func->setArg(2, begin);
+    func->setArg(3, end);
+    m_state.packed = true;
+    m_state.preheader = comp.cursor();
+
+    const auto field = [&](size_t axis, size_t offset)
+    { return asmjit::x86::qword_ptr(axes, static_cast<int32_t>(axis * sizeof(GridAxis) + offset)); };
+    std::vector<asmjit::x86::Xmm> starts;
+    std::vector<asmjit::x86::Xmm> steps;
+    std::vector<asmjit::x86::Gp> strides; // In bytes
+    for (size_t i = 0; i < dimensions; ++i)
+    {
+        starts.push_back(comp.newXmmPd());
+        comp.movq(starts.back(), field(i, offsetof(GridAxis, start)));
+        comp.unpcklpd(starts.back(), starts.back());
+        steps.push_back(comp.newXmmPd());
+        comp.movq(steps.back(), field(i, offsetof(GridAxis, step)));
+        comp.unpcklpd(steps.back(), steps.back());
+        strides.push_back(comp.newIntPtr());
+        comp.mov(strides.back(), field(i, offsetof(GridAxis, stride)));
+        comp.shl(strides.back(), 3);
+    }
+
+    SymbolRegisters coordinates;
+    const auto compile_point = [&](asmjit::x86::Xmm value)
+    {
+        m_state.registers = coordinates; // Drop the previous point's assignments
+        return m_ast->compile(comp, m_state, value);
+    };
+    // Loops over the points of an axis, the last one limited to [begin, end)
+    std::function<bool(size_t, asmjit::x86::Gp)> emit_axis = [&](size_t axis, asmjit::x86::Gp base)
+    {
+        asmjit::x86::Gp index = comp.newIntPtr("index");
+        asmjit::x86::Gp limit = comp.newIntPtr("limit");
+        if (axis == dimensions - 1)
+        {
+            comp.mov(index, begin);
+            comp.mov(limit, end);
+        }
+        else
+        {
+            comp.xor_(index, index);
+            comp.mov(limit, field(axis, offsetof(GridAxis, count)));
+        }
+        asmjit::Label done = comp.newLabel();
+        if (axis > 0)
+        {
+            asmjit::Label loop = comp.newLabel();
+            comp.cmp(index, limit);
+            comp.jae(done);
+            comp.bind(loop);
+            asmjit::x86::Xmm coordinate = comp.newXmmPd();
+            comp.cvtsi2sd(coordinate, index);
+            comp.mulsd(coordinate, steps[axis]);
+            comp.addsd(coordinate, starts[axis]);
+            comp.unpcklpd(coordinate, coordinate);
+            coordinates[m_grid_variables[axis]] = coordinate;
+            asmjit::x86::Gp row = comp.newIntPtr("row");
+            comp.mov(row, index);
+            comp.imul(row, strides[axis]);
+            comp.add(row, base);
+            if (!emit_axis(axis - 1, row))
+            {
+                return false;
+            }
+            comp.inc(index);
+            comp.cmp(index, limit);
+            comp.jb(loop);
+            comp.bind(done);
+            return true;
+        }
+
+        // Vector of indices [index, index + 1] advanced by two
+        asmjit::x86::Gp next = comp.newIntPtr("next");
+        asmjit::x86::Xmm indices = comp.newXmmPd("indices");
+        asmjit::x86::Xmm high = comp.newXmmPd();
+        asmjit::x86::Xmm two = comp.newXmmPd();
+        comp.lea(next, asmjit::x86::ptr(index, 1));
+        comp.cvtsi2sd(indices, index);
+        comp.cvtsi2sd(high, next);
+        comp.unpcklpd(indices, high);
+        load_constant(comp, m_state, two, 2.0);
+        asmjit::Label vector_loop = comp.newLabel();
+        asmjit::Label vector_done = comp.newLabel();
+        comp.bind(vector_loop);
+        comp.lea(next, asmjit::x86::ptr(index, 2));
+        comp.cmp(next, limit);
+        comp.ja(vector_done);
+        asmjit::x86::Xmm coordinate = comp.newXmmPd();
+        comp.movapd(coordinate, indices);
+        comp.mulpd(coordinate, steps[0]);
+        comp.addpd(coordinate, starts[0]);
+        coordinates[m_grid_variables[0]] = coordinate;
+        asmjit::x86::Xmm value = new_value_register(comp, m_state);
+        if (!compile_point(value))
+        {
+            return false;
+        }
+        comp.movupd(asmjit::x86::ptr(base, index, 3), value);
+        comp.addpd(indices, two);
+        comp.mov(index, next);
+        comp.jmp(vector_loop);
+        comp.bind(vector_done);
+
+        // The odd point left over
+        m_state.packed = false;
+        comp.cmp(index, limit);
+        comp.jae(done);
+        comp.cvtsi2sd(coordinate, index);
+        comp.mulsd(coordinate, steps[0]);
+        comp.addsd(coordinate, starts[0]);
+        value = new_value_register(comp, m_state);
+        if (!compile_point(value))
+        {
+            return false;
+        }
+        comp.movsd(asmjit::x86::ptr(base, index, 3), value);
+        comp.bind(done);
+        m_state.packed = true;
+        return true;
+    };
+    if (!emit_axis(dimensions - 1, results))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    comp.ret();
+    comp.endFunc();
+    emit_data_section(comp, m_state);
+    comp.finalize();
+
+    if (const asmjit::Error err = add_function(m_grid_function, code); err || !m_grid_function)
+    {
+        std::cerr << "Failed to compile grid formula: " << asmjit::DebugUtils::errorAsString(err) << '\n';
+        return false;
+    }
+    return true;
+}
+
+} // namespace internal
+
+} // namespace formula
@@ -1,25 +1,271 @@
 #pragma once
 
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
 #include <memory>
+#include <string>
 #include <string_view>
+#include <vector>
 
 namespace formula
 {
 
 class Node;
 
-class Formula
+enum class Reduction
+{
+    Sum,
+    Min,
+    Max,
+    Mean,
+};
+
+enum class Precision
+{
+    Double, // double data, double arithmetic
+    Single, // float data, float arithmetic
+    Mixed,  // float data, double arithmetic
+};
+
+// Integer formulas compute on int64 values scaled by 2^fraction_bits (0 for plain integers);
+// multiplication rescales with an arithmetic shift and division truncates.  Checked
+// arithmetic fails on overflow instead of wrapping around.
+struct IntegerFormat
+{
+    unsigned fraction_bits{}; // Less than 63
+    bool checked{};
+};
+
+// A batch variable read from memory laid out by the caller, such as a field of an array of
+// structs: the value of a row is the double at base + offset + row*stride bytes.
+struct StridedColumn
+{
+    const void *base{};
+    std::size_t offset{};
+    std::size_t stride{sizeof(double)};
+};
+
+// One axis of a grid with the points start + i*step for i < count.  stride is the distance in
+// the results between consecutive points; points along the first axis are always contiguous.
+struct GridAxis
+{
+    double start{};
+    double step{};
+    std::size_t count{};
+    std::size_t stride{1};
+};
+
+// Escape time iteration stops a row once its value exceeds bailout or is NaN, or after
+// max_iterations passes.
+struct IterationLimits
+{
+    double bailout{4.0};
+    std::uint32_t max_iterations{256};
+};
+
+// Executable memory of compiled code.  By default each formula owns its memory, which spreads
+// thousands of small functions over as many pages.  Shared memory packs the code of all
+// formulas into common blocks, keeping the code of hot formulas apart from the rest, and
+// large pages back the blocks with 2 MiB pages where the system provides them, so the
+// frequently called code spans few iTLB entries.
+struct JitMemory
+{
+    bool shared{};
+    bool large_pages{}; // Only with shared memory
+};
+
+// Value and partial derivatives with respect to the gradient variables;
+// values[i] and gradient[i] correspond to the i'th variable name.
+class GradientEvaluator
+{
+public:
+    virtual ~GradientEvaluator() = default;
+
+    virtual void set_gradient_variables(std::vector<std::string> names) = 0;
+    virtual double evaluate_gradient(const double *values, double *gradient) = 0;
+    virtual bool compile_gradient() = 0;
+};
+
+// Evaluation over a batch of rows; columns[i][row] is the value of the i'th batch variable.
+// Reductions fold the rows into a single value without storing the per-row results.
+class BatchEvaluator
+{
+public:
+    virtual ~BatchEvaluator() = default;
+
+    virtual void set_batch_variables(std::vector<std::string> names) = 0;
+    virtual void evaluate_batch(const double *const *columns, double *results, std::size_t count) = 0;
+    virtual void evaluate_batch(const float *const *columns, float *results, std::size_t count) = 0;
+    virtual double reduce(Reduction reduction, const double *const *columns, std::size_t count) = 0;
+    virtual double reduce(Reduction reduction, const float *const *columns, std::size_t count) = 0;
+    virtual bool compile_batch() = 0;
+    virtual bool compile_reduction(Reduction reduction) = 0;
+    // Double precision evaluation over strided columns, without repacking them.
+    virtual void evaluate_batch(const StridedColumn *columns, double *results, std::size_t count) = 0;
+    virtual bool compile_strided_batch() = 0;
+
+    // Precision of compiled code; Single and Mixed batch kernels take the float overloads.
+    virtual void set_precision(Precision precision) = 0;
+
+    // Value specialization of the compiled double batch kernel: once batch variables have kept
+    // one value over every row of calls consecutive evaluate_batch() calls, a kernel with those
+    // values folded in as constants is compiled.  Later calls check the specialized values
+    // and fall back to the generic kernel, restarting the profile, when one has changed.
+    // Zero, the default, disables profiling.
+    virtual void set_specialization_threshold(std::size_t calls) = 0;
+    virtual std::vector<std::string> specialized_variables() const = 0;
+
+    // rand() is uniform in [0, 1) and normal() standard normal.  Their values depend only on the
+    // seed, the stream, the position of the call in the text and the row, counted on over
+    // consecutive batches and reductions; setting the seed restarts the count.  Only batch
+    // evaluation and reductions, in double arithmetic when compiled, support them; the other
+    // entry points print an error and return NaN.
+    virtual void set_random_seed(std::uint32_t seed, std::uint32_t stream = 0) = 0;
+};
+
+// Double precision evaluation of a subset of the rows of the batch variables, leaving the other
+// results untouched.  The selection lists row indices; the mask selects row r with bit r % 64
+// of mask[r / 64].
+class SelectionEvaluator
 {
 public:
-    virtual ~Formula() = default;
+    virtual ~SelectionEvaluator() = default;
+
+    virtual void evaluate_selection(
+        const double *const *columns, const std::uint32_t *selection, std::size_t selected, double *results) = 0;
+    virtual void evaluate_masked(
+        const double *const *columns, const std::uint64_t *mask, std::size_t count, double *results) = 0;
+    virtual bool compile_selection() = 0;
+};
+
+// Evaluation over a grid of one to three axes, one per grid variable, with the coordinates
+// generated instead of read from columns.  The last axis is split among up to threads
+// threads, fewer for grids too small to share.  Returns false without one to three axes.
+class GridEvaluator
+{
+public:
+    virtual ~GridEvaluator() = default;
+
+    virtual void set_grid_variables(std::vector<std::string> names) = 0;
+    virtual bool evaluate_grid(const GridAxis *axes, double *results, unsigned threads) = 0;
+    virtual bool compile_grid() = 0;
+};
+
+// Fixed point evaluation; symbol values are converted to the format and the results are
+// scaled integers.  Returns false on a failed overflow check or division by zero.
+class IntegerEvaluator
+{
+public:
+    virtual ~IntegerEvaluator() = default;
+
+    virtual void set_integer_format(IntegerFormat format) = 0;
+    virtual bool evaluate_integer(std::int64_t &result) = 0;
+    virtual bool compile_integer() = 0;
+    virtual bool evaluate_integer_batch(
+        const std::int64_t *const *columns, std::int64_t *results, std::size_t count) = 0;
+    virtual bool compile_integer_batch() = 0;
+};
+
+// Complex evaluation; real symbol values have no imaginary part and i is the imaginary unit
+// unless set otherwise.  Products and quotients use the textbook formulas without the
+// overflow scaling of std::complex.  Exponents must be constant integers; returns false for
+// a formula complex mode doesn't support.
+class ComplexEvaluator
+{
+public:
+    virtual ~ComplexEvaluator() = default;
+
+    virtual void set_complex_value(std::string_view name, std::complex<double> value) = 0;
+    virtual bool evaluate_complex(std::complex<double> &result) = 0;
+    virtual bool compile_complex() = 0;
+    virtual bool evaluate_complex_batch(
+        const std::complex<double> *const *columns, std::complex<double> *results, std::size_t count) = 0;
+    virtual bool compile_complex_batch() = 0;
+};
+
+// Escape time iteration over a batch of rows: each row starts from its batch variable values
+// and evaluates the formula repeatedly, carrying the variables it assigns into the next pass.
+// results[row] is the last value and iterations[row] the number of passes.
+class IterationEvaluator
+{
+public:
+    virtual ~IterationEvaluator() = default;
+
+    virtual void set_iteration_limits(IterationLimits limits) = 0;
+    virtual void iterate(
+        const double *const *columns, double *results, std::uint32_t *iterations, std::size_t count) = 0;
+    virtual bool compile_iteration() = 0;
+};
+
+// A parsed formula.  Scalar evaluation is declared here; each other mode has its own interface,
+// so code that only uses one mode can take that interface instead of the whole formula.
+class Formula : public GradientEvaluator,
+                public BatchEvaluator,
+                public SelectionEvaluator,
+                public GridEvaluator,
+                public IntegerEvaluator,
+                public ComplexEvaluator,
+                public IterationEvaluator
+{
+public:
+    ~Formula() override = default;
 
     virtual void set_value(std::string_view name, double value) = 0;
+    // Value of a variable, including variables assigned by the last evaluate().
+    virtual double get_value(std::string_view name) const = 0;
 
     virtual double evaluate() = 0;
     virtual bool assemble() = 0;
     virtual bool compile() = 0;
+
+    // Destination of the generated assembly listing, stdout by default; nullptr disables it.
+    virtual void set_log_file(std::FILE *file) = 0;
+    // Places code compiled afterwards with that of the other hot formulas in shared memory.
+    virtual void set_hot(bool hot) = 0;
+};
+
+// Named formulas that read each other's results like cells of a spreadsheet: an identifier
+// naming another formula of the set is that formula's result.  Changing an input only marks
+// the formulas depending on it, directly or through other formulas, and recalculation
+// evaluates those in dependency order with independent formulas spread over the threads.
+class FormulaSet
+{
+public:
+    virtual ~FormulaSet() = default;
+
+    // Adds or replaces a formula; fails on a parse error or a circular reference.
+    virtual bool define(std::string_view name, std::string_view text) = 0;
+    virtual void set_value(std::string_view name, double value) = 0;
+    // Result of a formula, recalculated if needed, or the value of an input.
+    virtual double get_value(std::string_view name) = 0;
+    virtual void recalculate() = 0;
+    // Compiles the current and later defined formulas instead of interpreting them.
+    virtual bool compile() = 0;
+    // Up to threads threads evaluate the independent formulas of a level together; levels with
+    // few formulas stay on the calling thread.
+    virtual void set_threads(unsigned threads) = 0;
+    // Number of formula evaluations so far.
+    virtual std::size_t evaluations() const = 0;
+};
+
+// Where and why parse_fast() rejected its input; position is an offset into the text.
+struct ParseError
+{
+    std::size_t position{};
+    const char *message{};
 };
 
 std::shared_ptr<Formula> parse(std::string_view text);
 
+// Same grammar as parse() using a hand-written parser that reports errors instead of
+// throwing or printing them.
+std::shared_ptr<Formula> parse_fast(std::string_view text, ParseError *error = nullptr);
+
+std::shared_ptr<FormulaSet> make_formula_set();
+
+// Memory of the formulas created afterwards.
+void set_jit_memory(JitMemory memory);
+
 }
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace formula
+{
+
+constexpr std::size_t MAX_FUNCTION_ARGUMENTS{4};
+
+namespace detail
+{
+
+using NativeFunction = void (*)();
+
+bool register_function(std::string name, NativeFunction function, std::size_t arity);
+
+} // namespace detail
+
+// Makes name(arguments...) callable in formulas parsed afterwards.  The interpreter calls
+// function, as does compiled code once per lane; formula/inline_function.h adds code that
+// compiled code emits in place of the call.  Fails for names that aren't identifiers, the
+// built in rand and normal, and more than MAX_FUNCTION_ARGUMENTS arguments; registering a name
+// again replaces its function.
+//
+// Native functions are opaque to differentiation: the interpreted gradient of a call takes
+// central differences of function, and compile_gradient() fails for formulas with calls.
+// Integer and complex formulas don't support calls.
+template <typename... Args>
+bool register_function(std::string name, double (*function)(Args...))
+{
+    static_assert((std::is_same_v<Args, double> && ...), "Functions take and return doubles");
+    return detail::register_function(
+        std::move(name), reinterpret_cast<detail::NativeFunction>(function), sizeof...(Args));
+}
+
+} // namespace formula
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "formula/function.h"
+
+#include <asmjit/x86.h>
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace formula
+{
+
+// Registers of an inline function call in compiled code.  Scalar code holds each value in the
+// low lane; packed code holds a row in every lane, floats when single is set and doubles
+// otherwise.
+struct InlineCall
+{
+    asmjit::x86::Xmm result;
+    std::vector<asmjit::x86::Xmm> arguments; // Read only
+    bool packed{};
+    bool single{};
+};
+
+// Emits the instructions of a call on the caller's registers, or returns false to have the
+// compiled code call the native function instead.
+using InlineEmitter = std::function<bool(asmjit::x86::Compiler &comp, const InlineCall &call)>;
+
+namespace detail
+{
+
+bool register_function(std::string name, NativeFunction function, std::size_t arity, InlineEmitter emit);
+
+} // namespace detail
+
+// register_function() with code that compiled code emits wherever emit accepts the call;
+// the interpreter still calls function.
+template <typename... Args>
+bool register_function(std::string name, double (*function)(Args...), InlineEmitter emit)
+{
+    static_assert((std::is_same_v<Args, double> && ...), "Functions take and return doubles");
+    return detail::register_function(
+        std::move(name), reinterpret_cast<detail::NativeFunction>(function), sizeof...(Args), std::move(emit));
+}
+
+} // namespace formula
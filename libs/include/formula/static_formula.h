@@ -0,0 +1,701 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+namespace formula
+{
+
+namespace detail
+{
+
+enum class StaticNodeKind
+{
+    Number,
+    Variable,
+    Unary,
+    Binary,
+};
+
+struct StaticNode
+{
+    StaticNodeKind kind{};
+    char op{};
+    double value{};       // Number
+    std::size_t slot{};   // Variable
+    std::size_t left{};   // Operand of unary operators
+    std::size_t right{};
+};
+
+struct StaticStatement
+{
+    std::size_t slot{}; // Assigned variable, NO_SLOT for a bare expression
+    std::size_t value{};
+};
+
+struct StaticName
+{
+    std::size_t begin{};
+    std::size_t length{};
+    bool assigned{};
+};
+
+constexpr std::size_t NO_SLOT{std::numeric_limits<std::size_t>::max()};
+
+// Fixed capacity syntax tree; every node, statement and name consumes at least one
+// character of the text, so Capacity is the length of the text.
+template <std::size_t Capacity>
+struct StaticAst
+{
+    std::array<StaticNode, Capacity> nodes{};
+    std::size_t node_count{};
+    std::array<StaticStatement, Capacity> statements{};
+    std::size_t statement_count{};
+    std::array<StaticName, Capacity> names{};
+    std::size_t name_count{};
+    const char *error{};
+    std::size_t error_position{};
+    bool call{}; // The error is a function call
+};
+
+constexpr std::size_t static_length(const char *text)
+{
+    std::size_t length{};
+    while (text[length] != '\0')
+    {
+        ++length;
+    }
+    return length;
+}
+
+constexpr bool static_is_alpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+constexpr bool static_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+constexpr bool static_is_alnum(char c)
+{
+    return static_is_alpha(c) || static_is_digit(c) || c == '_';
+}
+
+constexpr int static_precedence(char op)
+{
+    if (op == '+' || op == '-')
+    {
+        return 1;
+    }
+    if (op == '*' || op == '/')
+    {
+        return 2;
+    }
+    return 0;
+}
+
+constexpr double static_power_of_ten(int exponent)
+{
+    double result{1.0};
+    for (int i = 0; i < (exponent < 0 ? -exponent : exponent); ++i)
+    {
+        result *= 10.0;
+    }
+    return result;
+}
+
+// Star addition chain for a positive exponent: values[0] is 1 and every later value is
+// the previous one plus values[operands[i]], so x^exponent takes length - 1 multiplications.
+constexpr std::size_t MAX_CHAIN_LENGTH{12};
+
+struct AdditionChain
+{
+    std::array<std::uint32_t, MAX_CHAIN_LENGTH> values{};
+    std::array<std::uint8_t, MAX_CHAIN_LENGTH> operands{};
+    std::size_t length{};
+};
+
+// Largest exponent magnitude lowered to multiplications; larger ones call pow, as squaring
+// many times compounds the rounding error.
+constexpr std::uint32_t MAX_CHAIN_EXPONENT{256};
+
+// Shortest star chains for the exponents up to MAX_CHAIN_EXPONENT + 1, which covers the
+// exponent n - 1 of derivatives.  The low 4 bits hold the number of multiplications and
+// every further 4 bits the operand of the next one.  They are the first chains found by an
+// iterative deepening search trying the larger operands first; a search at compile time
+// would exceed the constexpr operation limits for exponents like 191.
+constexpr std::array<std::uint64_t, MAX_CHAIN_EXPONENT + 2> SHORTEST_CHAINS{
+    0x0, 0x0, 0x1, 0x2, 0x102, 0x103, 0x1103, 0x1104, 0x2103, 0x2104, 0x12104, 0x12105, 0x22104, 0x22105, 0x122105,
+    0x330105, 0x32104, 0x32105, 0x132105, 0x132106, 0x232105, 0x232106, 0x1232106, 0x3420106, 0x332105, 0x332106,
+    0x1332106, 0x4402106, 0x2332106, 0x2332107, 0x4412106, 0x4412107, 0x432105, 0x432106, 0x1432106, 0x1432107,
+    0x2432106, 0x2432107, 0x12432107, 0x55022107, 0x3432106, 0x3432107, 0x13432107, 0x45302107, 0x23432107,
+    0x45402107, 0x45312107, 0x355022108, 0x4432106, 0x4432107, 0x14432107, 0x55032107, 0x24432107, 0x24432108,
+    0x55132107, 0x55132108, 0x34432107, 0x34432108, 0x134432108, 0x355032108, 0x55232107, 0x55232108, 0x155232108,
+    0x660232108, 0x5432106, 0x5432107, 0x15432107, 0x15432108, 0x25432107, 0x25432108, 0x125432108, 0x125432109,
+    0x35432107, 0x35432108, 0x135432108, 0x660332108, 0x235432108, 0x465302108, 0x661332108, 0x661332109,
+    0x45432107, 0x45432108, 0x145432108, 0x564032108, 0x245432108, 0x565032108, 0x564132108, 0x7702332109,
+    0x345432108, 0x345432109, 0x565132108, 0x4660332109, 0x564232108, 0x564232109, 0x4661332109, 0x6740232109,
+    0x55432107, 0x55432108, 0x155432108, 0x660432108, 0x255432108, 0x255432109, 0x661432108, 0x661432109,
+    0x355432108, 0x355432109, 0x1355432109, 0x3660432109, 0x662432108, 0x662432109, 0x1662432109, 0x7702432109,
+    0x455432108, 0x455432109, 0x1455432109, 0x4660432109, 0x2455432109, 0x5745032109, 0x4661432109, 0x5665032109,
+    0x663432108, 0x663432109, 0x1663432109, 0x7703432109, 0x2663432109, 0x6760332109, 0x7713432109, 0x771343210A,
+    0x65432107, 0x65432108, 0x165432108, 0x165432109, 0x265432108, 0x265432109, 0x1265432109, 0x7745402109,
+    0x365432108, 0x365432109, 0x1365432109, 0x136543210A, 0x2365432109, 0x236543210A, 0x1236543210A, 0x5770243210A,
+    0x465432108, 0x465432109, 0x1465432109, 0x7704432109, 0x2465432109, 0x5764032109, 0x7714432109, 0x771443210A,
+    0x3465432109, 0x5765032109, 0x5764132109, 0x3770443210A, 0x7724432109, 0x772443210A, 0x1772443210A,
+    0x8802443210A, 0x565432108, 0x565432109, 0x1565432109, 0x6750432109, 0x2565432109, 0x6760432109, 0x6751432109,
+    0x675143210A, 0x3565432109, 0x356543210A, 0x6761432109, 0x8803443210A, 0x6752432109, 0x675243210A,
+    0x8813443210A, 0x7850243210A, 0x4565432109, 0x456543210A, 0x1456543210A, 0x5770443210A, 0x6762432109,
+    0x676243210A, 0x5771443210A, 0x7860243210A, 0x6753432109, 0x675343210A, 0x1675343210A, 0x7850343210A,
+    0x5772443210A, 0x7863043210A, 0x7851343210A, 0x58802443210B, 0x665432108, 0x665432109, 0x1665432109,
+    0x7705432109, 0x2665432109, 0x266543210A, 0x7715432109, 0x771543210A, 0x3665432109, 0x366543210A, 0x1366543210A,
+    0x3770543210A, 0x7725432109, 0x772543210A, 0x1772543210A, 0x8802543210A, 0x4665432109, 0x466543210A,
+    0x1466543210A, 0x4770543210A, 0x2466543210A, 0x7864043210A, 0x4771543210A, 0x5776403210A, 0x7735432109,
+    0x773543210A, 0x1773543210A, 0x8803543210A, 0x2773543210A, 0x6875033210A, 0x8813543210A, 0x8813543210B,
+    0x5665432109, 0x566543210A, 0x1566543210A, 0x5770543210A, 0x2566543210A, 0x6856043210A, 0x5771543210A,
+    0x6776043210A, 0x3566543210A, 0x6875403210A, 0x6856143210A, 0x48803543210B, 0x5772543210A, 0x5772543210B,
+    0x6776143210A, 0x58802543210B, 0x7745432109, 0x774543210A, 0x1774543210A, 0x8804543210A, 0x2774543210A,
+    0x7870443210A, 0x8814543210A, 0x8814543210B, 0x3774543210A, 0x8856403210A, 0x7871443210A, 0x38804543210B,
+    0x8824543210A, 0x8824543210B, 0x18824543210B, 0x8856503210A, 0x765432108, 0x765432109};
+
+constexpr AdditionChain addition_chain(std::uint32_t exponent)
+{
+    AdditionChain chain;
+    chain.values[0] = 1;
+    chain.length = 1;
+    const std::uint64_t code = SHORTEST_CHAINS[exponent];
+    for (std::uint64_t step = 1; step <= (code & 0xF); ++step)
+    {
+        chain.operands[chain.length] = static_cast<std::uint8_t>(code >> 4 * step & 0xF);
+        chain.values[chain.length] = chain.values[chain.length - 1] + chain.values[chain.operands[chain.length]];
+        ++chain.length;
+    }
+    return chain;
+}
+
+constexpr double chain_power(double base, const AdditionChain &chain)
+{
+    std::array<double, MAX_CHAIN_LENGTH> powers{};
+    powers[0] = base;
+    for (std::size_t i = 1; i < chain.length; ++i)
+    {
+        powers[i] = powers[i - 1] * powers[chain.operands[i]];
+    }
+    return powers[chain.length - 1];
+}
+
+// Whether a constant exponent is lowered to multiplications by integer_power().
+constexpr bool is_chain_exponent(double exponent)
+{
+    return exponent >= -static_cast<double>(MAX_CHAIN_EXPONENT) &&
+        exponent <= static_cast<double>(MAX_CHAIN_EXPONENT) &&
+        exponent == static_cast<double>(static_cast<std::int64_t>(exponent));
+}
+
+// base^exponent with the multiplications of the addition chain and one division for
+// negative exponents, rounding exactly like the compiled code.
+constexpr double integer_power(double base, std::int64_t exponent)
+{
+    if (exponent == 0)
+    {
+        return 1.0;
+    }
+    const double power =
+        chain_power(base, addition_chain(static_cast<std::uint32_t>(exponent < 0 ? -exponent : exponent)));
+    return exponent < 0 ? 1.0 / power : power;
+}
+
+// Compile time counterpart of the FastParser in formula.cpp, accepting the same grammar
+// except for function calls: rand(), normal() and registered functions only exist at run time.
+template <std::size_t Capacity>
+class StaticParser
+{
+public:
+    constexpr explicit StaticParser(std::string_view text) :
+        m_text(text)
+    {
+    }
+
+    constexpr StaticAst<Capacity> parse()
+    {
+        do
+        {
+            if (!statement())
+            {
+                return m_ast;
+            }
+            if (!peek(';'))
+            {
+                break;
+            }
+            ++m_pos;
+        } while (!at_end());
+
+        if (!at_end())
+        {
+            fail("expected ';' or an operator");
+        }
+        return m_ast;
+    }
+
+private:
+    constexpr void skip_space()
+    {
+        while (m_pos < m_text.size() && (m_text[m_pos] == ' ' || (m_text[m_pos] >= '\t' && m_text[m_pos] <= '\r')))
+        {
+            ++m_pos;
+        }
+    }
+    constexpr bool at_end()
+    {
+        skip_space();
+        return m_pos == m_text.size();
+    }
+    constexpr bool peek(char c)
+    {
+        return !at_end() && m_text[m_pos] == c;
+    }
+    constexpr std::size_t fail(const char *message)
+    {
+        if (!m_ast.error)
+        {
+            m_ast.error = message;
+            m_ast.error_position = m_pos;
+        }
+        return NO_SLOT;
+    }
+    constexpr std::size_t add(StaticNode node)
+    {
+        m_ast.nodes[m_ast.node_count] = node;
+        return m_ast.node_count++;
+    }
+    constexpr std::size_t slot(std::size_t begin, std::size_t length)
+    {
+        const std::string_view name = m_text.substr(begin, length);
+        for (std::size_t i = 0; i < m_ast.name_count; ++i)
+        {
+            if (m_text.substr(m_ast.names[i].begin, m_ast.names[i].length) == name)
+            {
+                return i;
+            }
+        }
+        m_ast.names[m_ast.name_count] = StaticName{begin, length, false};
+        return m_ast.name_count++;
+    }
+    constexpr std::size_t identifier_length()
+    {
+        skip_space();
+        std::size_t end = m_pos;
+        if (end < m_text.size() && static_is_alpha(m_text[end]))
+        {
+            while (++end < m_text.size() && static_is_alnum(m_text[end]))
+            {
+            }
+        }
+        return end - m_pos;
+    }
+
+    constexpr bool statement();
+    constexpr std::size_t expression(int min_precedence);
+    constexpr std::size_t factor();
+    constexpr std::size_t primary();
+    constexpr bool number(double &value);
+
+    std::string_view m_text;
+    std::size_t m_pos{};
+    StaticAst<Capacity> m_ast{};
+};
+
+template <std::size_t Capacity>
+constexpr bool StaticParser<Capacity>::statement()
+{
+    const std::size_t start = m_pos;
+    std::size_t assigned{NO_SLOT};
+    if (const std::size_t length = identifier_length(); length != 0)
+    {
+        const std::size_t begin = m_pos;
+        m_pos += length;
+        if (peek('='))
+        {
+            ++m_pos;
+            assigned = slot(begin, length);
+            m_ast.names[assigned].assigned = true;
+        }
+        else
+        {
+            m_pos = start;
+        }
+    }
+    const std::size_t value = expression(1);
+    if (value == NO_SLOT)
+    {
+        return false;
+    }
+    m_ast.statements[m_ast.statement_count++] = StaticStatement{assigned, value};
+    return true;
+}
+
+template <std::size_t Capacity>
+constexpr std::size_t StaticParser<Capacity>::expression(int min_precedence)
+{
+    std::size_t left = factor();
+    while (left != NO_SLOT && !at_end())
+    {
+        const char op = m_text[m_pos];
+        const int op_precedence = static_precedence(op);
+        if (op_precedence == 0 || op_precedence < min_precedence)
+        {
+            break;
+        }
+        ++m_pos;
+        const std::size_t right = expression(op_precedence + 1);
+        if (right == NO_SLOT)
+        {
+            return NO_SLOT;
+        }
+        left = add(StaticNode{StaticNodeKind::Binary, op, 0.0, 0, left, right});
+    }
+    return left;
+}
+
+template <std::size_t Capacity>
+constexpr std::size_t StaticParser<Capacity>::factor()
+{
+    if (at_end())
+    {
+        return fail("expected a number, variable, '(' or unary operator");
+    }
+
+    const char c = m_text[m_pos];
+    if (c == '+' || c == '-')
+    {
+        ++m_pos;
+        const std::size_t operand = factor();
+        if (operand == NO_SLOT)
+        {
+            return NO_SLOT;
+        }
+        return add(StaticNode{StaticNodeKind::Unary, c, 0.0, 0, operand});
+    }
+    const std::size_t base = primary();
+    if (base == NO_SLOT || !peek('^'))
+    {
+        return base;
+    }
+    // Right associative: the exponent is again a factor
+    ++m_pos;
+    const std::size_t exponent = factor();
+    if (exponent == NO_SLOT)
+    {
+        return NO_SLOT;
+    }
+    return add(StaticNode{StaticNodeKind::Binary, '^', 0.0, 0, base, exponent});
+}
+
+template <std::size_t Capacity>
+constexpr std::size_t StaticParser<Capacity>::primary()
+{
+    if (double value{}; number(value))
+    {
+        return add(StaticNode{StaticNodeKind::Number, 0, value});
+    }
+    const char c = m_text[m_pos];
+    if (static_is_alpha(c))
+    {
+        const std::size_t begin = m_pos;
+        const std::size_t length = identifier_length();
+        m_pos += length;
+        if (peek('('))
+        {
+            m_ast.call = !m_ast.error;
+            return fail("function calls need formula::parse()");
+        }
+        return add(StaticNode{StaticNodeKind::Variable, 0, 0.0, slot(begin, length)});
+    }
+    if (c == '(')
+    {
+        ++m_pos;
+        const std::size_t result = expression(1);
+        if (result == NO_SLOT)
+        {
+            return NO_SLOT;
+        }
+        if (!peek(')'))
+        {
+            return fail("expected ')'");
+        }
+        ++m_pos;
+        return result;
+    }
+    return fail("expected a number, variable, '(' or unary operator");
+}
+
+// Accepts decimal digits with an optional fraction and exponent; signs are unary
+// operators.  Values are exact when the significant digits fit in 53 bits and the exponent
+// is within 22, and may differ in the last place otherwise.
+template <std::size_t Capacity>
+constexpr bool StaticParser<Capacity>::number(double &value)
+{
+    std::size_t pos = m_pos;
+    std::uint64_t mantissa{};
+    int exponent{};
+    bool any_digits{};
+    const auto digit = [&](bool fraction)
+    {
+        any_digits = true;
+        if (mantissa < std::numeric_limits<std::uint64_t>::max() / 10 - 1)
+        {
+            mantissa = mantissa * 10 + static_cast<std::uint64_t>(m_text[pos] - '0');
+            exponent -= fraction ? 1 : 0;
+        }
+        else if (!fraction)
+        {
+            ++exponent; // Digits beyond the precision of the mantissa only scale it
+        }
+        ++pos;
+    };
+    while (pos < m_text.size() && static_is_digit(m_text[pos]))
+    {
+        digit(false);
+    }
+    if (pos < m_text.size() && m_text[pos] == '.')
+    {
+        ++pos;
+        while (pos < m_text.size() && static_is_digit(m_text[pos]))
+        {
+            digit(true);
+        }
+    }
+    if (!any_digits)
+    {
+        return false;
+    }
+    if (pos < m_text.size() && (m_text[pos] == 'e' || m_text[pos] == 'E'))
+    {
+        std::size_t exponent_pos = pos + 1;
+        const bool negative_exponent = exponent_pos < m_text.size() && m_text[exponent_pos] == '-';
+        if (exponent_pos < m_text.size() && (m_text[exponent_pos] == '-' || m_text[exponent_pos] == '+'))
+        {
+            ++exponent_pos;
+        }
+        if (exponent_pos < m_text.size() && static_is_digit(m_text[exponent_pos]))
+        {
+            int written{};
+            while (exponent_pos < m_text.size() && static_is_digit(m_text[exponent_pos]))
+            {
+                written = written < 10000 ? written * 10 + (m_text[exponent_pos] - '0') : written;
+                ++exponent_pos;
+            }
+            exponent += negative_exponent ? -written : written;
+            pos = exponent_pos;
+        }
+    }
+
+    value = static_cast<double>(mantissa);
+    if (exponent < 0)
+    {
+        value /= static_power_of_ten(-exponent);
+    }
+    else
+    {
+        value *= static_power_of_ten(exponent);
+    }
+    m_pos = pos;
+    return true;
+}
+
+// Value of a number under unary signs, NaN for any other node.
+template <std::size_t Capacity>
+constexpr double static_constant(const StaticAst<Capacity> &ast, std::size_t index)
+{
+    const StaticNode &node = ast.nodes[index];
+    if (node.kind == StaticNodeKind::Number)
+    {
+        return node.value;
+    }
+    if (node.kind == StaticNodeKind::Unary)
+    {
+        const double operand = static_constant(ast, node.left);
+        return node.op == '-' ? -operand : operand;
+    }
+    return std::numeric_limits<double>::quiet_NaN();
+}
+
+template <std::size_t Capacity>
+constexpr StaticAst<Capacity> static_parse(const char *text)
+{
+    return StaticParser<Capacity>(std::string_view(text, static_length(text))).parse();
+}
+
+} // namespace detail
+
+// A formula parsed and specialized at compile time.  Text must be a constexpr character
+// array with static storage duration:
+//
+//     static constexpr char text[] = "a*b + 1";
+//     formula::StaticFormula<text> f;
+//     f.set_value("a", 2.0);
+//
+// Evaluation has the semantics of the interpreter behind formula::parse(), so code can
+// switch between the two, for any formula without function calls.  Names the formula
+// doesn't mention are ignored by set_value().
+template <const char *Text>
+class StaticFormula
+{
+    static constexpr std::size_t CAPACITY{detail::static_length(Text) + 1};
+    static constexpr detail::StaticAst<CAPACITY> AST{detail::static_parse<CAPACITY>(Text)};
+    static_assert(!AST.call, "rand(), normal() and registered functions need formula::parse()");
+    static_assert(AST.error == nullptr || AST.call, "formula text does not parse");
+    static_assert(AST.statement_count > 0 || AST.call, "formula text does not parse");
+
+public:
+    using Values = std::array<double, AST.name_count>;
+
+    StaticFormula()
+    {
+        if constexpr (slot("e") != detail::NO_SLOT)
+        {
+            m_symbols[slot("e")] = std::exp(1.0);
+        }
+        if constexpr (slot("pi") != detail::NO_SLOT)
+        {
+            m_symbols[slot("pi")] = std::atan2(0.0, -1.0);
+        }
+    }
+
+    // Index of a name in Values, NO_SLOT if the formula doesn't mention it; a constant
+    // slot avoids the name lookup when binding values.
+    static constexpr std::size_t slot(std::string_view name)
+    {
+        for (std::size_t i = 0; i < AST.name_count; ++i)
+        {
+            if (std::string_view(Text + AST.names[i].begin, AST.names[i].length) == name)
+            {
+                return i;
+            }
+        }
+        return detail::NO_SLOT;
+    }
+
+    void set_value(std::string_view name, double value)
+    {
+        if (const std::size_t index = slot(name); index != detail::NO_SLOT)
+        {
+            m_symbols[index] = value;
+        }
+    }
+    void set_value(std::size_t index, double value)
+    {
+        m_symbols[index] = value;
+    }
+    // Value of a variable, including variables assigned by the last evaluate().
+    double get_value(std::string_view name) const
+    {
+        if (const std::size_t index = slot(name); index != detail::NO_SLOT)
+        {
+            return AST.names[index].assigned ? m_outputs[index] : m_symbols[index];
+        }
+        return 0.0;
+    }
+
+    double evaluate()
+    {
+        m_outputs = m_symbols;
+        return run<0>(m_outputs);
+    }
+
+    // Evaluation with explicit variable values, usable in constant expressions.
+    static constexpr double evaluate(Values values)
+    {
+        return run<0>(values);
+    }
+
+private:
+    template <std::size_t Index>
+    static constexpr double run(Values &values)
+    {
+        constexpr detail::StaticStatement statement = AST.statements[Index];
+        const double value = evaluate_node<statement.value>(values);
+        if constexpr (statement.slot != detail::NO_SLOT)
+        {
+            values[statement.slot] = value;
+        }
+        if constexpr (Index + 1 < AST.statement_count)
+        {
+            return run<Index + 1>(values);
+        }
+        else
+        {
+            return value;
+        }
+    }
+
+    template <std::size_t Index>
+    static constexpr double evaluate_node(const Values &values)
+    {
+        constexpr detail::StaticNode node = AST.nodes[Index];
+        if constexpr (node.kind == detail::StaticNodeKind::Number)
+        {
+            return node.value;
+        }
+        else if constexpr (node.kind == detail::StaticNodeKind::Variable)
+        {
+            return values[node.slot];
+        }
+        else if constexpr (node.kind == detail::StaticNodeKind::Unary)
+        {
+            return node.op == '-' ? -evaluate_node<node.left>(values) : evaluate_node<node.left>(values);
+        }
+        else if constexpr (node.op == '^')
+        {
+            constexpr double exponent = detail::static_constant(AST, node.right);
+            if constexpr (!detail::is_chain_exponent(exponent))
+            {
+                return std::pow(evaluate_node<node.left>(values), evaluate_node<node.right>(values));
+            }
+            else if constexpr (exponent == 0.0)
+            {
+                return 1.0;
+            }
+            else
+            {
+                constexpr detail::AdditionChain chain =
+                    detail::addition_chain(static_cast<std::uint32_t>(exponent < 0.0 ? -exponent : exponent));
+                const double power = detail::chain_power(evaluate_node<node.left>(values), chain);
+                return exponent < 0.0 ? 1.0 / power : power;
+            }
+        }
+        else
+        {
+            const double left = evaluate_node<node.left>(values);
+            const double right = evaluate_node<node.right>(values);
+            if constexpr (node.op == '+')
+            {
+                return left + right;
+            }
+            else if constexpr (node.op == '-')
+            {
+                return left - right;
+            }
+            else if constexpr (node.op == '*')
+            {
+                return left * right;
+            }
+            else
+            {
+                return left / right;
+            }
+        }
+    }
+
+    Values m_symbols{};
+    Values m_outputs{};
+};
+
+} // namespace formula
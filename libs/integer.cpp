@@ -0,0 +1,145 @@
+#include "parsed_formula.h"
+
+namespace formula
+{
+
+namespace internal
+{
+
+IntegerSymbols ParsedFormula::integer_symbols() const
+{
+    IntegerSymbols symbols;
+    for (const auto &[name, value] : m_state.symbols)
+    {
+        symbols[name] = to_fixed(value, m_integer_format.fraction_bits);
+    }
+    return symbols;
+}
+
+bool ParsedFormula::evaluate_integer(std::int64_t &result)
+{
+    if (m_integer_function)
+    {
+        return m_integer_function(&result);
+    }
+
+    return m_ast->evaluate_integer(integer_symbols(), m_integer_format, result);
+}
+
+bool ParsedFormula::evaluate_integer_batch(
+    const std::int64_t *const *columns, std::int64_t *results, std::size_t count)
+{
+    if (m_integer_batch_function)
+    {
+        return m_integer_batch_function(columns, results, count);
+    }
+
+    IntegerSymbols symbols{integer_symbols()};
+    std::vector<std::int64_t *> slots;
+    for (const std::string &name : m_batch_variables)
+    {
+        slots.push_back(&symbols[name]);
+    }
+    for (std::size_t row = 0; row < count; ++row)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            *slots[i] = columns[i][row];
+        }
+        if (!m_ast->evaluate_integer(symbols, m_integer_format, results[row]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Returns true from the end of the function body and false from the overflow label, then
+// adds the function to the runtime.
+template <typename Function>
+bool ParsedFormula::finish_integer_function(asmjit::x86::Compiler &comp, asmjit::CodeHolder &code, Function *&function)
+{
+    asmjit::x86::Gp status = comp.newInt32("status");
+    comp.mov(status, 1);
+    comp.ret(status);
+    comp.bind(m_state.overflow);
+    comp.xor_(status, status);
+    comp.ret(status);
+    return finish_function(comp, code, function, "integer formula");
+}
+
+bool ParsedFormula::compile_integer()
+{
+    m_integer_function = nullptr;
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    m_state.integer = m_integer_format;
+    asmjit::x86::Compiler comp(&code);
+    asmjit::FuncNode *func = comp.addFunc(asmjit::FuncSignature::build<bool, std::int64_t *>());
+    asmjit::x86::Gp output = comp.newIntPtr("output");
+    func->setArg(0, output);
+    m_state.overflow = comp.newLabel();
+    asmjit::x86::Gp result = comp.newInt64("result");
+    if (!m_ast->compile_integer(comp, m_state, result))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    comp.mov(asmjit::x86::qword_ptr(output), result);
+    return finish_integer_function(comp, code, m_integer_function);
+}
+
+// A scalar loop in general purpose registers; checked arithmetic needs the flags of every
+// operation, which packed instructions don't provide.
+bool ParsedFormula::compile_integer_batch()
+{
+    m_integer_batch_function = nullptr;
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    m_state.integer = m_integer_format;
+    asmjit::x86::Compiler comp(&code);
+    asmjit::x86::Gp columns;
+    asmjit::x86::Gp results;
+    asmjit::x86::Gp count;
+    begin_function(comp,
+        asmjit::FuncSignature::build<bool, const std::int64_t *const *, std::int64_t *, std::size_t>(),
+        {{&columns, "columns"}, {&results, "results"}, {&count, "count"}});
+    m_state.overflow = comp.newLabel();
+
+    const std::vector<bool> reads = read_columns();
+    const std::vector<asmjit::x86::Gp> bases = load_bases(comp, columns, reads);
+    asmjit::x86::Gp row = comp.newIntPtr("row");
+    const auto emit_row = [&]
+    {
+        bind_inputs(m_state.integer_registers, reads,
+            [&](size_t column)
+            {
+                asmjit::x86::Gp input = comp.newInt64();
+                comp.mov(input, asmjit::x86::qword_ptr(bases[column], row, 3));
+                return input;
+            });
+        asmjit::x86::Gp value = comp.newInt64("value");
+        if (!m_ast->compile_integer(comp, m_state, value))
+        {
+            return false;
+        }
+        comp.mov(asmjit::x86::qword_ptr(results, row, 3), value);
+        return true;
+    };
+    if (!emit_row_loop(comp, row, count, 1, comp.newLabel(), emit_row))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    return finish_integer_function(comp, code, m_integer_batch_function);
+}
+
+} // namespace internal
+
+} // namespace formula
@@ -0,0 +1,627 @@
+#include "nodes.h"
+#include "random.h"
+
+#include <iostream>
+#include <iterator>
+#include <limits>
+
+namespace formula
+{
+
+namespace internal
+{
+
+namespace
+{
+
+double call_native(detail::NativeFunction native, const std::vector<double> &arguments)
+{
+    const double *a = arguments.data();
+    switch (arguments.size())
+    {
+    case 0:
+        return reinterpret_cast<double (*)()>(native)();
+    case 1:
+        return reinterpret_cast<double (*)(double)>(native)(a[0]);
+    case 2:
+        return reinterpret_cast<double (*)(double, double)>(native)(a[0], a[1]);
+    case 3:
+        return reinterpret_cast<double (*)(double, double, double)>(native)(a[0], a[1], a[2]);
+    default:
+        return reinterpret_cast<double (*)(double, double, double, double)>(native)(a[0], a[1], a[2], a[3]);
+    }
+}
+
+} // namespace
+
+double NumberNode::evaluate(const SymbolTable &) const
+{
+    return m_value;
+}
+
+double NumberNode::evaluate_gradient(const SymbolTable &, const Variables &variables, double *gradient) const
+{
+    std::fill_n(gradient, variables.size(), 0.0);
+    return m_value;
+}
+
+bool NumberNode::evaluate_integer(const IntegerSymbols &, const IntegerFormat &format, std::int64_t &result) const
+{
+    result = to_fixed(m_value, format.fraction_bits);
+    return true;
+}
+
+bool NumberNode::evaluate_complex(const ComplexSymbols &, Complex &result) const
+{
+    result = m_value;
+    return true;
+}
+
+void NumberNode::collect_variables(VariableSet &) const
+{
+}
+
+std::shared_ptr<Node> NumberNode::specialize(const SymbolTable &) const
+{
+    return nullptr;
+}
+
+double IdentifierNode::evaluate(const SymbolTable &symbols) const
+{
+    if (const auto &it = symbols.find(m_name); it != symbols.end())
+    {
+        return it->second;
+    }
+    return 0.0;
+}
+
+double IdentifierNode::evaluate_gradient(
+    const SymbolTable &symbols, const Variables &variables, double *gradient) const
+{
+    for (size_t i = 0; i < variables.size(); ++i)
+    {
+        gradient[i] = variables[i] == m_name ? 1.0 : 0.0;
+    }
+    return evaluate(symbols);
+}
+
+bool IdentifierNode::evaluate_integer(
+    const IntegerSymbols &symbols, const IntegerFormat &, std::int64_t &result) const
+{
+    const auto &it = symbols.find(m_name);
+    result = it != symbols.end() ? it->second : 0;
+    return true;
+}
+
+bool IdentifierNode::evaluate_complex(const ComplexSymbols &symbols, Complex &result) const
+{
+    const auto &it = symbols.find(m_name);
+    result = it != symbols.end() ? it->second : 0.0;
+    return true;
+}
+
+void IdentifierNode::collect_variables(VariableSet &names) const
+{
+    names.insert(m_name);
+}
+
+std::shared_ptr<Node> IdentifierNode::specialize(const SymbolTable &constants) const
+{
+    const auto it = constants.find(m_name);
+    return it != constants.end() ? std::make_shared<NumberNode>(it->second) : nullptr;
+}
+
+double UnaryOpNode::evaluate(const SymbolTable &symbols) const
+{
+    if (m_op == '+')
+    {
+        return m_operand->evaluate(symbols);
+    }
+    if (m_op == '-')
+    {
+        return -m_operand->evaluate(symbols);
+    }
+    throw std::runtime_error(std::string{"Invalid unary prefix operator '"} + m_op + "'");
+}
+
+double UnaryOpNode::evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const
+{
+    if (m_op == '+')
+    {
+        return m_operand->evaluate_gradient(symbols, variables, gradient);
+    }
+    if (m_op == '-')
+    {
+        const double value = m_operand->evaluate_gradient(symbols, variables, gradient);
+        std::transform(gradient, gradient + variables.size(), gradient, std::negate<double>());
+        return -value;
+    }
+    throw std::runtime_error(std::string{"Invalid unary prefix operator '"} + m_op + "'");
+}
+
+bool UnaryOpNode::evaluate_integer(
+    const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const
+{
+    if (!m_operand->evaluate_integer(symbols, format, result))
+    {
+        return false;
+    }
+    if (m_op == '+')
+    {
+        return true;
+    }
+    if (m_op == '-')
+    {
+        return integer_arithmetic(format, '-', 0, result, result);
+    }
+    throw std::runtime_error(std::string{"Invalid unary prefix operator '"} + m_op + "'");
+}
+
+bool UnaryOpNode::evaluate_complex(const ComplexSymbols &symbols, Complex &result) const
+{
+    if (!m_operand->evaluate_complex(symbols, result))
+    {
+        return false;
+    }
+    if (m_op == '+')
+    {
+        return true;
+    }
+    if (m_op == '-')
+    {
+        result = complex_arithmetic('-', 0.0, result);
+        return true;
+    }
+    throw std::runtime_error(std::string{"Invalid unary prefix operator '"} + m_op + "'");
+}
+
+void UnaryOpNode::collect_variables(VariableSet &names) const
+{
+    m_operand->collect_variables(names);
+}
+
+std::shared_ptr<Node> UnaryOpNode::specialize(const SymbolTable &constants) const
+{
+    std::shared_ptr<Node> operand = m_operand->specialize(constants);
+    if (!operand)
+    {
+        return nullptr;
+    }
+    auto node = std::make_shared<UnaryOpNode>(m_op, operand);
+    if (operand->constant_value())
+    {
+        return std::make_shared<NumberNode>(node->evaluate(SymbolTable{}));
+    }
+    return node;
+}
+
+std::optional<double> UnaryOpNode::constant_value() const
+{
+    std::optional<double> value = m_operand->constant_value();
+    if (value && m_op == '-')
+    {
+        *value = -*value;
+    }
+    return value;
+}
+
+double BinaryOpNode::evaluate(const SymbolTable &symbols) const
+{
+    const double left = m_left->evaluate(symbols);
+    const double right = m_right->evaluate(symbols);
+    if (m_op == '+')
+    {
+        return left + right;
+    }
+    if (m_op == '-')
+    {
+        return left - right;
+    }
+    if (m_op == '*')
+    {
+        return left * right;
+    }
+    if (m_op == '/')
+    {
+        return left / right;
+    }
+    throw std::runtime_error(std::string{"Invalid binary operator '"} + m_op + "'");
+}
+
+double BinaryOpNode::evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const
+{
+    std::vector<double> right_gradient(variables.size());
+    const double left = m_left->evaluate_gradient(symbols, variables, gradient);
+    const double right = m_right->evaluate_gradient(symbols, variables, right_gradient.data());
+    if (m_op == '+')
+    {
+        for (size_t i = 0; i < variables.size(); ++i)
+        {
+            gradient[i] += right_gradient[i];
+        }
+        return left + right;
+    }
+    if (m_op == '-')
+    {
+        for (size_t i = 0; i < variables.size(); ++i)
+        {
+            gradient[i] -= right_gradient[i];
+        }
+        return left - right;
+    }
+    if (m_op == '*')
+    {
+        // (uv)' = u'v + uv'
+        for (size_t i = 0; i < variables.size(); ++i)
+        {
+            gradient[i] = gradient[i] * right + left * right_gradient[i];
+        }
+        return left * right;
+    }
+    if (m_op == '/')
+    {
+        // (u/v)' = (u' - (u/v)v')/v
+        const double quotient = left / right;
+        for (size_t i = 0; i < variables.size(); ++i)
+        {
+            gradient[i] = (gradient[i] - quotient * right_gradient[i]) / right;
+        }
+        return quotient;
+    }
+    throw std::runtime_error(std::string{"Invalid binary operator '"} + m_op + "'");
+}
+
+bool BinaryOpNode::evaluate_integer(
+    const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const
+{
+    std::int64_t left{};
+    std::int64_t right{};
+    return m_left->evaluate_integer(symbols, format, left) && m_right->evaluate_integer(symbols, format, right) &&
+        integer_arithmetic(format, m_op, left, right, result);
+}
+
+bool BinaryOpNode::evaluate_complex(const ComplexSymbols &symbols, Complex &result) const
+{
+    Complex right;
+    if (!m_left->evaluate_complex(symbols, result) || !m_right->evaluate_complex(symbols, right))
+    {
+        return false;
+    }
+    result = complex_arithmetic(m_op, result, right);
+    return true;
+}
+
+void BinaryOpNode::collect_variables(VariableSet &names) const
+{
+    m_left->collect_variables(names);
+    m_right->collect_variables(names);
+}
+
+std::shared_ptr<Node> BinaryOpNode::specialize(const SymbolTable &constants) const
+{
+    std::shared_ptr<Node> left = m_left->specialize(constants);
+    std::shared_ptr<Node> right = m_right->specialize(constants);
+    if (!left && !right)
+    {
+        return nullptr;
+    }
+    auto node = std::make_shared<BinaryOpNode>(left ? left : m_left, m_op, right ? right : m_right);
+    if (node->m_left->constant_value() && node->m_right->constant_value())
+    {
+        return std::make_shared<NumberNode>(node->evaluate(SymbolTable{}));
+    }
+    return node;
+}
+
+double PowerNode::evaluate(const SymbolTable &symbols) const
+{
+    const double base = m_base->evaluate(symbols);
+    if (m_integer_exponent)
+    {
+        return chain_power(base, *m_integer_exponent);
+    }
+    return std::pow(base, m_exponent->evaluate(symbols));
+}
+
+double PowerNode::evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const
+{
+    const double base = m_base->evaluate_gradient(symbols, variables, gradient);
+    if (m_integer_exponent)
+    {
+        // (u^n)' = n u^(n-1) u'
+        const std::int64_t n = m_integer_exponent->value;
+        const double slope = n == 0 ? 0.0 : static_cast<double>(n) * chain_power(base, *m_slope_exponent);
+        for (size_t i = 0; i < variables.size(); ++i)
+        {
+            gradient[i] *= slope;
+        }
+        return chain_power(base, *m_integer_exponent);
+    }
+
+    // (u^v)' = v u^(v-1) u' + u^v log(u) v', leaving out the second term where v' is zero
+    // so negative bases with constant exponents keep a finite derivative
+    std::vector<double> exponent_gradient(variables.size());
+    const double exponent = m_exponent->evaluate_gradient(symbols, variables, exponent_gradient.data());
+    const double power = std::pow(base, exponent);
+    const double slope = exponent * std::pow(base, exponent - 1.0);
+    const double log_base = std::log(base);
+    for (size_t i = 0; i < variables.size(); ++i)
+    {
+        gradient[i] *= slope;
+        if (exponent_gradient[i] != 0.0)
+        {
+            gradient[i] += power * log_base * exponent_gradient[i];
+        }
+    }
+    return power;
+}
+
+bool PowerNode::evaluate_integer(const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const
+{
+    if (!m_integer_exponent)
+    {
+        std::cerr << "Integer formulas need constant integer exponents\n";
+        return false;
+    }
+    std::int64_t base{};
+    return m_base->evaluate_integer(symbols, format, base) &&
+        integer_power(format, base, *m_integer_exponent, result);
+}
+
+bool PowerNode::evaluate_complex(const ComplexSymbols &symbols, Complex &result) const
+{
+    if (!m_integer_exponent)
+    {
+        std::cerr << "Complex formulas need constant integer exponents\n";
+        return false;
+    }
+    if (!m_base->evaluate_complex(symbols, result))
+    {
+        return false;
+    }
+    result = complex_power(result, *m_integer_exponent);
+    return true;
+}
+
+void PowerNode::collect_variables(VariableSet &names) const
+{
+    m_base->collect_variables(names);
+    m_exponent->collect_variables(names);
+}
+
+// A folded exponent takes the integer exponent path of the new node.
+std::shared_ptr<Node> PowerNode::specialize(const SymbolTable &constants) const
+{
+    std::shared_ptr<Node> base = m_base->specialize(constants);
+    std::shared_ptr<Node> exponent = m_exponent->specialize(constants);
+    if (!base && !exponent)
+    {
+        return nullptr;
+    }
+    auto node = std::make_shared<PowerNode>(base ? base : m_base, exponent ? exponent : m_exponent);
+    if (node->m_base->constant_value() && node->m_exponent->constant_value())
+    {
+        return std::make_shared<NumberNode>(node->evaluate(SymbolTable{}));
+    }
+    return node;
+}
+
+double RandomNode::evaluate(const SymbolTable &symbols) const
+{
+    const auto row = symbols.find(RANDOM_ROW);
+    if (row == symbols.end())
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    const double mantissa = random_mantissa(static_cast<std::uint64_t>(row->second),
+        static_cast<std::uint32_t>(symbols.at(RANDOM_SEED)), static_cast<std::uint32_t>(symbols.at(RANDOM_STREAM)),
+        m_site);
+    return m_normal ? inverse_normal(mantissa - OPEN_INTERVAL_OFFSET) : mantissa - 1.0;
+}
+
+double RandomNode::evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const
+{
+    std::fill(gradient, gradient + variables.size(), 0.0);
+    return evaluate(symbols);
+}
+
+bool RandomNode::evaluate_integer(const IntegerSymbols &, const IntegerFormat &, std::int64_t &) const
+{
+    std::cerr << "Integer formulas don't support random variables\n";
+    return false;
+}
+
+bool RandomNode::evaluate_complex(const ComplexSymbols &, Complex &) const
+{
+    std::cerr << "Complex formulas don't support random variables\n";
+    return false;
+}
+
+// The reserved row symbol marks the formula as one that needs rows to count.
+void RandomNode::collect_variables(VariableSet &names) const
+{
+    names.insert(RANDOM_ROW);
+}
+
+std::shared_ptr<Node> RandomNode::specialize(const SymbolTable &) const
+{
+    return nullptr;
+}
+
+double CallNode::evaluate(const SymbolTable &symbols) const
+{
+    std::vector<double> arguments;
+    for (const std::shared_ptr<Node> &argument : m_arguments)
+    {
+        arguments.push_back(argument->evaluate(symbols));
+    }
+    return call_native(m_function->native, arguments);
+}
+
+double CallNode::evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const
+{
+    std::vector<double> arguments;
+    std::vector<std::vector<double>> argument_gradients;
+    for (const std::shared_ptr<Node> &argument : m_arguments)
+    {
+        std::vector<double> &argument_gradient = argument_gradients.emplace_back(variables.size());
+        arguments.push_back(argument->evaluate_gradient(symbols, variables, argument_gradient.data()));
+    }
+
+    // Native functions are opaque, so each partial derivative is a central difference
+    std::fill(gradient, gradient + variables.size(), 0.0);
+    for (std::size_t i = 0; i < arguments.size(); ++i)
+    {
+        const double value = arguments[i];
+        const double step = std::cbrt(std::numeric_limits<double>::epsilon()) * std::max(1.0, std::abs(value));
+        arguments[i] = value + step;
+        const double above = call_native(m_function->native, arguments);
+        arguments[i] = value - step;
+        const double below = call_native(m_function->native, arguments);
+        arguments[i] = value;
+        const double partial = (above - below) / (2.0 * step);
+        for (std::size_t j = 0; j < variables.size(); ++j)
+        {
+            gradient[j] += partial * argument_gradients[i][j];
+        }
+    }
+    return call_native(m_function->native, arguments);
+}
+
+bool CallNode::evaluate_integer(const IntegerSymbols &, const IntegerFormat &, std::int64_t &) const
+{
+    std::cerr << "Integer formulas don't support function calls\n";
+    return false;
+}
+
+bool CallNode::evaluate_complex(const ComplexSymbols &, Complex &) const
+{
+    std::cerr << "Complex formulas don't support function calls\n";
+    return false;
+}
+
+void CallNode::collect_variables(VariableSet &names) const
+{
+    for (const std::shared_ptr<Node> &argument : m_arguments)
+    {
+        argument->collect_variables(names);
+    }
+}
+
+// Functions may have side effects, so calls with constant arguments aren't folded.
+std::shared_ptr<Node> CallNode::specialize(const SymbolTable &constants) const
+{
+    std::vector<std::shared_ptr<Node>> arguments;
+    bool specialized{};
+    for (const std::shared_ptr<Node> &argument : m_arguments)
+    {
+        std::shared_ptr<Node> value = argument->specialize(constants);
+        specialized = specialized || value;
+        arguments.push_back(value ? value : argument);
+    }
+    return specialized ? std::make_shared<CallNode>(m_function, std::move(arguments)) : nullptr;
+}
+
+double ProgramNode::evaluate(const SymbolTable &symbols) const
+{
+    return evaluate(symbols, nullptr);
+}
+
+double ProgramNode::evaluate(const SymbolTable &symbols, double *outputs) const
+{
+    SymbolTable locals{symbols};
+    double result{};
+    for (const Statement &statement : m_statements)
+    {
+        result = statement.value->evaluate(locals);
+        if (!statement.name.empty())
+        {
+            locals[statement.name] = result;
+        }
+    }
+    if (outputs)
+    {
+        for (size_t i = 0; i < m_outputs.size(); ++i)
+        {
+            outputs[i] = locals[m_outputs[i]];
+        }
+    }
+    return result;
+}
+
+double ProgramNode::evaluate_gradient(const SymbolTable &, const Variables &, double *) const
+{
+    throw std::runtime_error("Gradients of multi-statement formulas are not supported");
+}
+
+bool ProgramNode::evaluate_integer(
+    const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const
+{
+    IntegerSymbols locals{symbols};
+    for (const Statement &statement : m_statements)
+    {
+        if (!statement.value->evaluate_integer(locals, format, result))
+        {
+            return false;
+        }
+        if (!statement.name.empty())
+        {
+            locals[statement.name] = result;
+        }
+    }
+    return true;
+}
+
+bool ProgramNode::evaluate_complex(const ComplexSymbols &symbols, Complex &result) const
+{
+    ComplexSymbols locals{symbols};
+    for (const Statement &statement : m_statements)
+    {
+        if (!statement.value->evaluate_complex(locals, result))
+        {
+            return false;
+        }
+        if (!statement.name.empty())
+        {
+            locals[statement.name] = result;
+        }
+    }
+    return true;
+}
+
+// Variables read before the program assigns them.
+void ProgramNode::collect_variables(VariableSet &names) const
+{
+    VariableSet assigned;
+    for (const Statement &statement : m_statements)
+    {
+        VariableSet reads;
+        statement.value->collect_variables(reads);
+        std::set_difference(
+            reads.begin(), reads.end(), assigned.begin(), assigned.end(), std::inserter(names, names.end()));
+        if (!statement.name.empty())
+        {
+            assigned.insert(statement.name);
+        }
+    }
+}
+
+// Assignments hide the constants from the statements after them.
+std::shared_ptr<Node> ProgramNode::specialize(const SymbolTable &constants) const
+{
+    SymbolTable visible{constants};
+    std::vector<Statement> statements;
+    bool changed{};
+    for (const Statement &statement : m_statements)
+    {
+        std::shared_ptr<Node> value = statement.value->specialize(visible);
+        changed = changed || value;
+        statements.push_back({statement.name, value ? value : statement.value});
+        visible.erase(statement.name);
+    }
+    return changed ? std::make_shared<ProgramNode>(std::move(statements)) : nullptr;
+}
+
+} // namespace internal
+
+} // namespace formula
@@ -0,0 +1,187 @@
+#include "parsed_formula.h"
+
+#include <limits>
+
+namespace formula
+{
+
+namespace internal
+{
+
+void ParsedFormula::iterate(
+    const double *const *columns, double *results, std::uint32_t *iterations, std::size_t count)
+{
+    if (m_iteration_function)
+    {
+        m_iteration_function(columns, results, iterations, count);
+        return;
+    }
+    if (rejects_random("iterate"))
+    {
+        std::fill(results, results + count, std::numeric_limits<double>::quiet_NaN());
+        std::fill(iterations, iterations + count, 0U);
+        return;
+    }
+
+    // Assigned variables restart from their symbol values in every row
+    SymbolTable symbols{m_state.symbols};
+    const Variables carried{m_program ? m_program->outputs() : Variables{}};
+    std::vector<double> initial;
+    std::vector<double> outputs(carried.size());
+    std::vector<double *> carried_slots;
+    for (const std::string &name : carried)
+    {
+        const auto it = m_state.symbols.find(name);
+        initial.push_back(it != m_state.symbols.end() ? it->second : 0.0);
+        carried_slots.push_back(&symbols[name]);
+    }
+    std::vector<double *> slots;
+    for (const std::string &name : m_batch_variables)
+    {
+        slots.push_back(&symbols[name]);
+    }
+    for (std::size_t row = 0; row < count; ++row)
+    {
+        for (size_t i = 0; i < carried_slots.size(); ++i)
+        {
+            *carried_slots[i] = initial[i];
+        }
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            *slots[i] = columns[i][row];
+        }
+        double value{};
+        std::uint32_t passes{};
+        while (passes < m_iteration_limits.max_iterations)
+        {
+            value = m_program ? m_program->evaluate(symbols, outputs.data()) : m_ast->evaluate(symbols);
+            ++passes;
+            for (size_t i = 0; i < carried_slots.size(); ++i)
+            {
+                *carried_slots[i] = outputs[i];
+            }
+            if (!(value <= m_iteration_limits.bailout))
+            {
+                break;
+            }
+        }
+        results[row] = value;
+        iterations[row] = passes;
+    }
+}
+
+// Rows are iterated two at a time, one per lane.  A lane that escapes keeps its value and
+// count while the other one continues, and the loop ends once neither lane is active.
+bool ParsedFormula::compile_iteration()
+{
+    m_iteration_function = nullptr;
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    asmjit::x86::Compiler comp(&code);
+    asmjit::x86::Gp columns;
+    asmjit::x86::Gp results;
+    asmjit::x86::Gp iterations;
+    asmjit::x86::Gp count;
+    begin_function(comp,
+        asmjit::FuncSignature::build<void, const double *const *, double *, std::uint32_t *, std::size_t>(),
+        {{&columns, "columns"}, {&results, "results"}, {&iterations, "iterations"}, {&count, "count"}});
+
+    const std::vector<bool> reads = read_columns();
+    const std::vector<asmjit::x86::Gp> bases = load_bases(comp, columns, reads);
+    asmjit::x86::Gp row = comp.newIntPtr("row");
+    asmjit::x86::Gp limit = comp.newInt64("limit");
+    comp.mov(limit, static_cast<std::uint64_t>(m_iteration_limits.max_iterations));
+    m_state.preheader = comp.cursor();
+
+    const Variables carried_names{m_program ? m_program->outputs() : Variables{}};
+    const auto iterate_rows = [&]
+    {
+        bind_inputs(m_state.registers, reads,
+            [&](size_t column)
+            {
+                asmjit::x86::Xmm input = new_value_register(comp, m_state);
+                const asmjit::x86::Mem mem = asmjit::x86::ptr(bases[column], row, 3);
+                m_state.packed ? comp.movupd(input, mem) : comp.movsd(input, mem);
+                return input;
+            });
+        const SymbolRegisters inputs{m_state.registers};
+        SymbolRegisters carried;
+        for (const std::string &name : carried_names)
+        {
+            carried[name] = new_value_register(comp, m_state);
+            IdentifierNode(name).compile(comp, m_state, carried[name]);
+        }
+        asmjit::x86::Xmm value = new_value_register(comp, m_state);
+        asmjit::x86::Xmm passes = comp.newXmm("passes");
+        asmjit::x86::Xmm active = comp.newXmm("active");
+        asmjit::x86::Xmm bailout = new_value_register(comp, m_state);
+        asmjit::x86::Gp pass = comp.newInt64("pass");
+        comp.xorpd(value, value);
+        comp.pxor(passes, passes);
+        comp.pcmpeqd(active, active);
+        load_constant(comp, m_state, bailout, m_iteration_limits.bailout);
+        comp.xor_(pass, pass);
+
+        asmjit::Label loop = comp.newLabel();
+        asmjit::Label exit = comp.newLabel();
+        comp.cmp(pass, limit);
+        comp.jae(exit);
+        comp.bind(loop);
+        m_state.registers = inputs;
+        for (const auto &[name, reg] : carried)
+        {
+            m_state.registers[name] = reg;
+        }
+        asmjit::x86::Xmm next = new_value_register(comp, m_state);
+        if (!m_ast->compile(comp, m_state, next))
+        {
+            return false;
+        }
+        for (const auto &[name, reg] : carried)
+        {
+            emit_select(comp, reg, active, m_state.registers[name]);
+        }
+        emit_select(comp, value, active, next);
+        comp.psubq(passes, active); // Active lanes are -1
+        asmjit::x86::Xmm inside = new_value_register(comp, m_state);
+        comp.movapd(inside, next);
+        comp.cmppd(inside, bailout, asmjit::Imm(2)); // Less or equal, false for NaN
+        comp.andpd(active, inside);
+        comp.inc(pass);
+        comp.cmp(pass, limit);
+        comp.jae(exit);
+        asmjit::x86::Gp lanes = comp.newInt32("lanes");
+        comp.movmskpd(lanes, active);
+        comp.test(lanes, m_state.packed ? 3 : 1);
+        comp.jnz(loop);
+        comp.bind(exit);
+
+        comp.pshufd(passes, passes, 0x08); // Low halves of the 64 bit counts
+        if (m_state.packed)
+        {
+            comp.movupd(asmjit::x86::ptr(results, row, 3), value);
+            comp.movq(asmjit::x86::qword_ptr(iterations, row, 2), passes);
+        }
+        else
+        {
+            comp.movsd(asmjit::x86::ptr(results, row, 3), value);
+            comp.movd(asmjit::x86::dword_ptr(iterations, row, 2), passes);
+        }
+        return true;
+    };
+
+    if (!emit_row_loop(comp, row, count, 2, comp.newLabel(), iterate_rows))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    comp.ret();
+    return finish_function(comp, code, m_iteration_function, "iteration");
+}
+
+} // namespace internal
+
+} // namespace formula
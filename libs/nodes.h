@@ -0,0 +1,320 @@
+#pragma once
+
+#include "emitter.h"
+#include "functions.h"
+
+#include <algorithm>
+#include <memory_resource>
+
+namespace formula
+{
+
+namespace internal
+{
+
+class Node
+{
+public:
+    virtual ~Node() = default;
+
+    virtual double evaluate(const SymbolTable &symbols) const = 0;
+    virtual bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const = 0;
+    virtual bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const = 0;
+
+    // Forward mode differentiation: returns the value and writes d(value)/d(variables[i]) to gradient[i].
+    virtual double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const = 0;
+    virtual bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const = 0;
+
+    // Fixed point evaluation: returns false on a failed overflow check or division by zero.
+    virtual bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const = 0;
+    virtual bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const = 0;
+
+    // Complex evaluation: returns false for what complex formulas don't support.  compile()
+    // emits complex code when state.complex is set.
+    virtual bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const = 0;
+
+    // Adds the variables whose values the node reads.
+    virtual void collect_variables(VariableSet &names) const = 0;
+
+    // Copy with the constants substituted for their variables and the constant subexpressions
+    // folded, or nullptr when the node reads none of them.
+    virtual std::shared_ptr<Node> specialize(const SymbolTable &constants) const = 0;
+
+    // Value of a number literal under unary signs.
+    virtual std::optional<double> constant_value() const
+    {
+        return std::nullopt;
+    }
+};
+
+class NumberNode : public Node
+{
+public:
+    NumberNode(double value) :
+        m_value(value)
+    {
+    }
+    ~NumberNode() override = default;
+
+    double evaluate(const SymbolTable & /*symbols*/) const override;
+    bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const override;
+    bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const override;
+    double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const override;
+    bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const override;
+    bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const override;
+    bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const override;
+    bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const override;
+    void collect_variables(VariableSet &names) const override;
+    std::shared_ptr<Node> specialize(const SymbolTable &constants) const override;
+    std::optional<double> constant_value() const override
+    {
+        return m_value;
+    }
+
+private:
+    double m_value{};
+};
+
+class IdentifierNode : public Node
+{
+public:
+    IdentifierNode(std::string value) :
+        m_name(std::move(value))
+    {
+    }
+    ~IdentifierNode() override = default;
+
+    double evaluate(const SymbolTable &symbols) const override;
+    bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const override;
+    bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const override;
+    double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const override;
+    bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const override;
+    bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const override;
+    bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const override;
+    bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const override;
+    void collect_variables(VariableSet &names) const override;
+    std::shared_ptr<Node> specialize(const SymbolTable &constants) const override;
+
+private:
+    std::string m_name;
+};
+
+class UnaryOpNode : public Node
+{
+public:
+    UnaryOpNode(char op, std::shared_ptr<Node> operand) :
+        m_op(op),
+        m_operand(std::move(operand))
+    {
+    }
+    ~UnaryOpNode() override = default;
+
+    double evaluate(const SymbolTable &symbols) const override;
+    bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const override;
+    bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const override;
+    double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const override;
+    bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const override;
+    bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const override;
+    bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const override;
+    bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const override;
+    void collect_variables(VariableSet &names) const override;
+    std::shared_ptr<Node> specialize(const SymbolTable &constants) const override;
+    std::optional<double> constant_value() const override;
+
+private:
+    char m_op;
+    std::shared_ptr<Node> m_operand;
+};
+
+class BinaryOpNode : public Node
+{
+public:
+    BinaryOpNode() = default;
+    BinaryOpNode(std::shared_ptr<Node> left, char op, std::shared_ptr<Node> right) :
+        m_left(std::move(left)),
+        m_op(op),
+        m_right(std::move(right))
+    {
+    }
+    ~BinaryOpNode() override = default;
+
+    double evaluate(const SymbolTable &symbols) const override;
+    bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const override;
+    bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const override;
+    double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const override;
+    bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const override;
+    bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const override;
+    bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const override;
+    bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const override;
+    void collect_variables(VariableSet &names) const override;
+    std::shared_ptr<Node> specialize(const SymbolTable &constants) const override;
+
+private:
+    std::shared_ptr<Node> m_left;
+    char m_op;
+    std::shared_ptr<Node> m_right;
+};
+
+// base^exponent.  Constant integer exponents are multiplied out along an addition chain,
+// other exponents evaluate exp(exponent*log(base)) in the compiled code.
+class PowerNode : public Node
+{
+public:
+    PowerNode(std::shared_ptr<Node> base, std::shared_ptr<Node> exponent) :
+        m_base(std::move(base)),
+        m_exponent(std::move(exponent))
+    {
+        if (const std::optional<double> value = m_exponent->constant_value();
+            value && detail::is_chain_exponent(*value))
+        {
+            m_integer_exponent.emplace(static_cast<std::int64_t>(*value));
+            m_slope_exponent.emplace(m_integer_exponent->value - 1);
+        }
+    }
+    ~PowerNode() override = default;
+
+    double evaluate(const SymbolTable &symbols) const override;
+    bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const override;
+    bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const override;
+    double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const override;
+    bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const override;
+    bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const override;
+    bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const override;
+    bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const override;
+    void collect_variables(VariableSet &names) const override;
+    std::shared_ptr<Node> specialize(const SymbolTable &constants) const override;
+
+private:
+    std::shared_ptr<Node> m_base;
+    std::shared_ptr<Node> m_exponent;
+    std::optional<ChainExponent> m_integer_exponent;
+    std::optional<ChainExponent> m_slope_exponent; // Of the derivative
+};
+
+// rand() and normal(): one value per row from a counter based generator keyed by the seed,
+// with the stream and the position of the call in the text selecting the sequence.  Only
+// batch and reduction kernels, and their interpreter, have rows to count; elsewhere the value
+// is NaN.
+class RandomNode : public Node
+{
+public:
+    RandomNode(bool normal, std::uint32_t site) :
+        m_normal(normal),
+        m_site(site)
+    {
+    }
+    ~RandomNode() override = default;
+
+    double evaluate(const SymbolTable &symbols) const override;
+    bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const override;
+    bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const override;
+    double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const override;
+    bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const override;
+    bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const override;
+    bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const override;
+    bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const override;
+    void collect_variables(VariableSet &names) const override;
+    std::shared_ptr<Node> specialize(const SymbolTable &constants) const override;
+
+private:
+    bool m_normal;
+    std::uint32_t m_site;
+};
+
+class CallNode : public Node
+{
+public:
+    CallNode(std::shared_ptr<const UserFunction> function, std::vector<std::shared_ptr<Node>> arguments) :
+        m_function(std::move(function)),
+        m_arguments(std::move(arguments))
+    {
+    }
+    ~CallNode() override = default;
+
+    double evaluate(const SymbolTable &symbols) const override;
+    bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const override;
+    bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const override;
+    double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const override;
+    bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const override;
+    bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const override;
+    bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const override;
+    bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const override;
+    void collect_variables(VariableSet &names) const override;
+    std::shared_ptr<Node> specialize(const SymbolTable &constants) const override;
+
+private:
+    std::shared_ptr<const UserFunction> m_function;
+    std::vector<std::shared_ptr<Node>> m_arguments;
+};
+
+using Expr = std::shared_ptr<Node>;
+
+struct Statement
+{
+    std::string name; // Assigned variable, empty for a bare expression
+    Expr value;
+};
+
+// A sequence of statements; the value of the program is the value of the last statement.
+class ProgramNode : public Node
+{
+public:
+    ProgramNode(std::vector<Statement> statements) :
+        m_statements(std::move(statements))
+    {
+        for (const Statement &statement : m_statements)
+        {
+            if (!statement.name.empty() &&
+                std::find(m_outputs.begin(), m_outputs.end(), statement.name) == m_outputs.end())
+            {
+                m_outputs.push_back(statement.name);
+            }
+        }
+    }
+    ~ProgramNode() override = default;
+
+    double evaluate(const SymbolTable &symbols) const override;
+    double evaluate(const SymbolTable &symbols, double *outputs) const;
+    bool assemble(asmjit::x86::Assembler &assem, EmitterState &state) const override;
+    bool compile(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result) const override;
+    double evaluate_gradient(const SymbolTable &symbols, const Variables &variables, double *gradient) const override;
+    bool compile_gradient(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Xmm result,
+        const TangentRegisters &gradient) const override;
+    bool evaluate_integer(
+        const IntegerSymbols &symbols, const IntegerFormat &format, std::int64_t &result) const override;
+    bool compile_integer(asmjit::x86::Compiler &comp, EmitterState &state, asmjit::x86::Gp result) const override;
+    bool evaluate_complex(const ComplexSymbols &symbols, Complex &result) const override;
+    void collect_variables(VariableSet &names) const override;
+    std::shared_ptr<Node> specialize(const SymbolTable &constants) const override;
+
+    const Variables &outputs() const
+    {
+        return m_outputs;
+    }
+
+private:
+    std::vector<Statement> m_statements;
+    Variables m_outputs; // Assigned variables in order of first assignment
+};
+
+using Arena = std::shared_ptr<std::pmr::memory_resource>;
+
+} // namespace internal
+
+} // namespace formula
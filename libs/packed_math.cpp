@@ -0,0 +1,256 @@
+#include "packed_math.h"
+#include "random.h"
+
+#include <limits>
+
+namespace formula
+{
+
+namespace internal
+{
+
+asmjit::x86::Xmm PackedMath::copy(asmjit::x86::Xmm value)
+{
+    asmjit::x86::Xmm result = m_comp.newXmm();
+    m_comp.movaps(result, value);
+    return result;
+}
+
+asmjit::x86::Xmm PackedMath::constant(double value)
+{
+    asmjit::x86::Xmm result = m_comp.newXmm();
+    load_constant(m_comp, m_state, result, value);
+    return result;
+}
+
+asmjit::x86::Xmm PackedMath::mask(std::uint64_t double_bits, std::uint32_t single_bits)
+{
+    asmjit::x86::Xmm result = m_comp.newXmm();
+    load_bits(m_comp, m_state, result,
+        m_state.single ? static_cast<std::uint64_t>(single_bits) << 32 | single_bits : double_bits);
+    return result;
+}
+
+void PackedMath::emit(asmjit::InstId pd, asmjit::InstId ps, asmjit::x86::Xmm result, asmjit::x86::Xmm operand)
+{
+    m_comp.emit(m_state.single ? ps : pd, result, operand);
+}
+
+asmjit::x86::Xmm PackedMath::compare(asmjit::x86::Xmm left, asmjit::x86::Xmm right, std::uint32_t predicate)
+{
+    using Inst = asmjit::x86::Inst;
+    asmjit::x86::Xmm result = copy(left);
+    m_comp.emit(m_state.single ? Inst::kIdCmpps : Inst::kIdCmppd, result, right, asmjit::Imm(predicate));
+    return result;
+}
+
+// result = value in the lanes where mask is set
+void PackedMath::select(asmjit::x86::Xmm result, asmjit::x86::Xmm mask, asmjit::x86::Xmm value)
+{
+    emit_select(m_comp, result, mask, value);
+}
+
+// Logarithm of a positive normal number from its exponent field and a series in the mantissa.
+void PackedMath::log_normal(asmjit::x86::Xmm result, asmjit::x86::Xmm x)
+{
+    using Inst = asmjit::x86::Inst;
+    const bool single = m_state.single;
+    asmjit::x86::Xmm exponent = copy(x);
+    if (single)
+    {
+        m_comp.psrld(exponent, 23);
+    }
+    else
+    {
+        m_comp.psrlq(exponent, 52);
+        m_comp.pshufd(exponent, exponent, 0x08); // Low halves of both lanes for cvtdq2pd
+    }
+    emit(Inst::kIdCvtdq2pd, Inst::kIdCvtdq2ps, exponent, exponent);
+    asmjit::x86::Xmm mantissa = copy(x);
+    m_comp.andps(mantissa, mask(0x000FFFFFFFFFFFFF, 0x007FFFFF));
+    asmjit::x86::Xmm one = constant(1.0);
+    m_comp.orps(mantissa, one); // Mantissa in [1, 2)
+
+    // Halve mantissas above sqrt(2) so the series argument stays small
+    asmjit::x86::Xmm large = compare(constant(std::sqrt(2.0)), mantissa, LESS);
+    asmjit::x86::Xmm scale = constant(1.0);
+    select(scale, large, constant(0.5));
+    emit(Inst::kIdMulpd, Inst::kIdMulps, mantissa, scale);
+    m_comp.andps(large, one);
+    emit(Inst::kIdAddpd, Inst::kIdAddps, exponent, large);
+    emit(Inst::kIdSubpd, Inst::kIdSubps, exponent, constant(single ? 127.0 : 1023.0));
+
+    // log(m) = 2 atanh(f) = 2 (f + f^3/3 + f^5/5 + ...) with f = (m - 1)/(m + 1)
+    asmjit::x86::Xmm f = copy(mantissa);
+    emit(Inst::kIdSubpd, Inst::kIdSubps, f, one);
+    emit(Inst::kIdAddpd, Inst::kIdAddps, mantissa, one);
+    emit(Inst::kIdDivpd, Inst::kIdDivps, f, mantissa);
+    asmjit::x86::Xmm square = copy(f);
+    emit(Inst::kIdMulpd, Inst::kIdMulps, square, f);
+    const int terms = single ? 6 : 11;
+    asmjit::x86::Xmm series = constant(1.0 / (2 * terms - 1));
+    for (int k = terms - 2; k >= 0; --k)
+    {
+        emit(Inst::kIdMulpd, Inst::kIdMulps, series, square);
+        emit(Inst::kIdAddpd, Inst::kIdAddps, series, constant(1.0 / (2 * k + 1)));
+    }
+    emit(Inst::kIdMulpd, Inst::kIdMulps, series, f);
+    emit(Inst::kIdAddpd, Inst::kIdAddps, series, series);
+
+    // exponent*log(2) + log(m) with log(2) split so the high product is exact
+    asmjit::x86::Xmm low = copy(exponent);
+    emit(Inst::kIdMulpd, Inst::kIdMulps, low, constant(single ? -2.12194440e-4 : 1.90821492927058770002e-10));
+    emit(Inst::kIdAddpd, Inst::kIdAddps, series, low);
+    emit(Inst::kIdMulpd, Inst::kIdMulps, exponent, constant(single ? 0.693359375 : 6.93147180369123816490e-01));
+    emit(Inst::kIdAddpd, Inst::kIdAddps, exponent, series);
+    m_comp.movaps(result, exponent);
+}
+
+void PackedMath::log(asmjit::x86::Xmm result, asmjit::x86::Xmm x)
+{
+    const bool single = m_state.single;
+    asmjit::x86::Xmm value = m_comp.newXmm();
+    log_normal(value, x);
+    const double min_normal = single ? std::numeric_limits<float>::min() : std::numeric_limits<double>::min();
+    select(value, compare(x, constant(min_normal), LESS), constant(-std::numeric_limits<double>::infinity()));
+    select(value, compare(x, constant(0.0), LESS), constant(std::numeric_limits<double>::quiet_NaN()));
+    select(value, compare(x, constant(std::numeric_limits<double>::infinity()), NOT_LESS), x); // Infinity and NaN
+    m_comp.movaps(result, value);
+}
+
+void PackedMath::exp(asmjit::x86::Xmm result, asmjit::x86::Xmm x)
+{
+    using Inst = asmjit::x86::Inst;
+    const bool single = m_state.single;
+    const double max_argument = single ? 88.72283935546875 : 709.782712893384;
+    const double min_argument = single ? -87.33654475 : -708.3964185322641;
+
+    // x = n log(2) + r with |r| <= log(2)/2 and exp(x) = 2^n exp(r)
+    asmjit::x86::Xmm clamped = copy(x);
+    emit(Inst::kIdMinpd, Inst::kIdMinps, clamped, constant(max_argument));
+    emit(Inst::kIdMaxpd, Inst::kIdMaxps, clamped, constant(min_argument));
+    asmjit::x86::Xmm scaled = copy(clamped);
+    emit(Inst::kIdMulpd, Inst::kIdMulps, scaled, constant(1.4426950408889634));
+    emit(Inst::kIdMinpd, Inst::kIdMinps, scaled, constant(single ? 127.0 : 1023.0));
+    asmjit::x86::Xmm n = m_comp.newXmm();
+    emit(Inst::kIdCvtpd2dq, Inst::kIdCvtps2dq, n, scaled);
+    asmjit::x86::Xmm whole = m_comp.newXmm();
+    emit(Inst::kIdCvtdq2pd, Inst::kIdCvtdq2ps, whole, n);
+    asmjit::x86::Xmm reduced = copy(clamped);
+    asmjit::x86::Xmm part = copy(whole);
+    emit(Inst::kIdMulpd, Inst::kIdMulps, part, constant(single ? 0.693359375 : 6.93147180369123816490e-01));
+    emit(Inst::kIdSubpd, Inst::kIdSubps, reduced, part);
+    emit(Inst::kIdMulpd, Inst::kIdMulps, whole, constant(single ? -2.12194440e-4 : 1.90821492927058770002e-10));
+    emit(Inst::kIdSubpd, Inst::kIdSubps, reduced, whole);
+
+    // Taylor series of exp(r)
+    const int degree = single ? 7 : 13;
+    std::array<double, 14> factorials{1.0};
+    for (int k = 1; k <= degree; ++k)
+    {
+        factorials[k] = factorials[k - 1] * k;
+    }
+    asmjit::x86::Xmm series = constant(1.0 / factorials[degree]);
+    for (int k = degree - 1; k >= 0; --k)
+    {
+        emit(Inst::kIdMulpd, Inst::kIdMulps, series, reduced);
+        emit(Inst::kIdAddpd, Inst::kIdAddps, series, constant(1.0 / factorials[k]));
+    }
+
+    // 2^n from its exponent field
+    if (single)
+    {
+        m_comp.paddd(n, mask(0, 127));
+        m_comp.pslld(n, 23);
+    }
+    else
+    {
+        m_comp.pshufd(n, n, 0x50); // Each integer into the high half of its lane
+        m_comp.paddd(n, mask(0x000003FF000003FF, 0));
+        m_comp.pslld(n, 20);
+        m_comp.andps(n, mask(0xFFFFFFFF00000000, 0));
+    }
+    emit(Inst::kIdMulpd, Inst::kIdMulps, series, n);
+
+    select(series, compare(constant(max_argument), x, LESS), constant(std::numeric_limits<double>::infinity()));
+    select(series, compare(x, constant(min_argument), LESS), constant(0.0));
+    select(series, compare(x, x, UNORDERED), x);
+    m_comp.movaps(result, series);
+}
+
+void PackedMath::power(asmjit::x86::Xmm result, asmjit::x86::Xmm x, asmjit::x86::Xmm y)
+{
+    using Inst = asmjit::x86::Inst;
+    const bool single = m_state.single;
+    asmjit::x86::Xmm value = copy(x);
+    m_comp.andps(value, mask(0x7FFFFFFFFFFFFFFF, 0x7FFFFFFF));
+    log(value, value);
+    emit(Inst::kIdMulpd, Inst::kIdMulps, value, y);
+    exp(value, value);
+
+    // Negative bases: the lowest bit of an integer exponent is the sign of the result
+    asmjit::x86::Xmm negative = compare(x, constant(0.0), LESS);
+    asmjit::x86::Xmm truncated = m_comp.newXmm();
+    emit(Inst::kIdCvttpd2dq, Inst::kIdCvttps2dq, truncated, y);
+    asmjit::x86::Xmm whole = m_comp.newXmm();
+    emit(Inst::kIdCvtdq2pd, Inst::kIdCvtdq2ps, whole, truncated);
+    asmjit::x86::Xmm fractional = compare(whole, y, NOT_EQUAL);
+    m_comp.pslld(truncated, 31);
+    if (!single)
+    {
+        m_comp.pshufd(truncated, truncated, 0x40); // Into the high half of each lane
+    }
+    m_comp.andps(truncated, mask(0x8000000000000000, 0x80000000));
+    m_comp.andps(truncated, negative);
+    m_comp.xorps(value, truncated);
+    m_comp.andps(fractional, negative);
+    select(value, fractional, constant(std::numeric_limits<double>::quiet_NaN()));
+
+    // x^0 is 1 for every x
+    select(value, compare(y, constant(0.0), EQUAL), constant(1.0));
+    m_comp.movaps(result, value);
+}
+
+template <std::size_t N>
+asmjit::x86::Xmm PackedMath::horner(const std::array<double, N> &coefficients, asmjit::x86::Xmm x)
+{
+    asmjit::x86::Xmm result = constant(coefficients[0]);
+    for (std::size_t i = 1; i < N; ++i)
+    {
+        m_comp.mulpd(result, x);
+        m_comp.addpd(result, constant(coefficients[i]));
+    }
+    return result;
+}
+
+// Both approximations are evaluated and the tail one is selected outside the central region.
+void PackedMath::inverse_normal(asmjit::x86::Xmm result, asmjit::x86::Xmm p)
+{
+    asmjit::x86::Xmm q = copy(p);
+    m_comp.subpd(q, constant(0.5));
+    asmjit::x86::Xmm r = copy(q);
+    m_comp.mulpd(r, q);
+    asmjit::x86::Xmm central = horner(NORMAL_CENTRAL_NUMERATOR, r);
+    m_comp.mulpd(central, q);
+    m_comp.divpd(central, horner(NORMAL_CENTRAL_DENOMINATOR, r));
+
+    asmjit::x86::Xmm t = constant(1.0);
+    m_comp.subpd(t, p);
+    m_comp.minpd(t, p);
+    asmjit::x86::Xmm s = m_comp.newXmm();
+    log(s, t);
+    m_comp.mulpd(s, constant(-2.0));
+    m_comp.sqrtpd(s, s);
+    asmjit::x86::Xmm tail = horner(NORMAL_TAIL_NUMERATOR, s);
+    m_comp.divpd(tail, horner(NORMAL_TAIL_DENOMINATOR, s));
+    asmjit::x86::Xmm upper = compare(constant(0.5), p, LESS);
+    m_comp.andpd(upper, mask(0x8000000000000000, 0));
+    m_comp.xorpd(tail, upper);
+
+    select(central, compare(t, constant(NORMAL_LOW), LESS), tail);
+    m_comp.movaps(result, central);
+}
+
+} // namespace internal
+
+} // namespace formula
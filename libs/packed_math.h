@@ -0,0 +1,59 @@
+#pragma once
+
+#include "emitter.h"
+
+#include <cstddef>
+
+namespace formula
+{
+
+namespace internal
+{
+
+// Vectorizable elementary functions for the power operator.  Packed instructions are used
+// for scalars as well, where only the low lane is meaningful; single precision takes
+// shorter series.
+class PackedMath
+{
+public:
+    PackedMath(asmjit::x86::Compiler &comp, EmitterState &state) :
+        m_comp(comp),
+        m_state(state)
+    {
+    }
+
+    // Natural logarithm; subnormals count as zero.
+    void log(asmjit::x86::Xmm result, asmjit::x86::Xmm x);
+    // Exponential; results below the normal range flush to zero.
+    void exp(asmjit::x86::Xmm result, asmjit::x86::Xmm x);
+    // x^y as exp(y*log|x|), negated for a negative x and an odd y.  Negative bases with
+    // fractional exponents, or exponents beyond 32 bit integers, give NaN.
+    void power(asmjit::x86::Xmm result, asmjit::x86::Xmm x, asmjit::x86::Xmm y);
+    // Standard normal quantile of p in (0, 1); double precision only.
+    void inverse_normal(asmjit::x86::Xmm result, asmjit::x86::Xmm p);
+
+private:
+    // cmppd and cmpps predicates
+    static constexpr std::uint32_t EQUAL{0};
+    static constexpr std::uint32_t LESS{1};
+    static constexpr std::uint32_t UNORDERED{3};
+    static constexpr std::uint32_t NOT_EQUAL{4};
+    static constexpr std::uint32_t NOT_LESS{5};
+
+    asmjit::x86::Xmm copy(asmjit::x86::Xmm value);
+    asmjit::x86::Xmm constant(double value);
+    asmjit::x86::Xmm mask(std::uint64_t double_bits, std::uint32_t single_bits);
+    void emit(asmjit::InstId pd, asmjit::InstId ps, asmjit::x86::Xmm result, asmjit::x86::Xmm operand);
+    asmjit::x86::Xmm compare(asmjit::x86::Xmm left, asmjit::x86::Xmm right, std::uint32_t predicate);
+    void select(asmjit::x86::Xmm result, asmjit::x86::Xmm mask, asmjit::x86::Xmm value);
+    void log_normal(asmjit::x86::Xmm result, asmjit::x86::Xmm x);
+    template <std::size_t N>
+    asmjit::x86::Xmm horner(const std::array<double, N> &coefficients, asmjit::x86::Xmm x);
+
+    asmjit::x86::Compiler &m_comp;
+    EmitterState &m_state;
+};
+
+} // namespace internal
+
+} // namespace formula
@@ -0,0 +1,425 @@
+#pragma once
+
+#include "nodes.h"
+#include "random.h"
+
+#include <cstdio>
+#include <initializer_list>
+#include <iostream>
+
+namespace formula
+{
+
+namespace internal
+{
+
+using Function = double(double *outputs);
+using GradientFunction = double(const double *values, double *gradient);
+using BatchFunction = double(const double *const *columns, double *results, std::size_t count);
+using FloatBatchFunction = double(const float *const *columns, float *results, std::size_t count);
+using IntegerFunction = bool(std::int64_t *result);
+using IntegerBatchFunction = bool(const std::int64_t *const *columns, std::int64_t *results, std::size_t count);
+using SelectionFunction = void(
+    const double *const *columns, const std::uint32_t *selection, std::size_t selected, double *results);
+using StridedBatchFunction = void(const StridedColumn *columns, double *results, std::size_t count);
+using GridFunction = void(const GridAxis *axes, double *results, std::size_t begin, std::size_t end);
+using IterationFunction = void(
+    const double *const *columns, double *results, std::uint32_t *iterations, std::size_t count);
+using ComplexFunction = void(Complex *result);
+using ComplexBatchFunction = void(const Complex *const *columns, Complex *results, std::size_t count);
+
+// Batch variable indices and the values a kernel is specialized on.
+using SpecializedValues = std::vector<std::pair<std::size_t, double>>;
+
+// Batch variable value seen by every profiled call, unless it varied.
+struct ValueProfile
+{
+    double value{};
+    bool varying{};
+};
+
+// Starts a function of the signature, creating a named pointer or size register for each argument.
+void begin_function(asmjit::x86::Compiler &comp, const asmjit::FuncSignature &signature,
+    std::initializer_list<std::pair<asmjit::x86::Gp *, const char *>> arguments);
+
+// Base pointers of the columns of an array of column pointers, loaded only where reads is set.
+std::vector<asmjit::x86::Gp> load_bases(
+    asmjit::x86::Compiler &comp, asmjit::x86::Gp columns, const std::vector<bool> &reads);
+
+JitMemory &default_jit_memory();
+
+// Process wide executable memory for formulas created with shared JIT memory, one runtime per
+// combination of page size and hotness.  Never destroyed, so formulas in static storage can
+// still release their functions at exit.
+class SharedCode
+{
+public:
+    static SharedCode &instance()
+    {
+        static SharedCode *code = new SharedCode;
+        return *code;
+    }
+
+    asmjit::JitRuntime &runtime(bool large_pages, bool hot)
+    {
+        return *m_runtimes[(large_pages ? 2 : 0) + (hot ? 1 : 0)];
+    }
+
+private:
+    SharedCode()
+    {
+        for (size_t i = 0; i < m_runtimes.size(); ++i)
+        {
+            asmjit::JitAllocator::CreateParams params{};
+            if (i >= 2)
+            {
+                // The allocator falls back to regular pages when no large pages are available
+                params.options = asmjit::JitAllocatorOptions::kUseLargePages |
+                    asmjit::JitAllocatorOptions::kAlignBlockSizeToLargePage;
+            }
+            m_runtimes[i] = std::make_unique<asmjit::JitRuntime>(&params);
+        }
+    }
+
+    std::array<std::unique_ptr<asmjit::JitRuntime>, 4> m_runtimes;
+};
+
+class ParsedFormula : public Formula
+{
+public:
+    ParsedFormula(std::shared_ptr<Node> ast, Arena arena = {}) :
+        m_arena(std::move(arena)),
+        m_ast(ast)
+    {
+        m_state.symbols["e"] = std::exp(1.0);
+        m_state.symbols["pi"] = std::atan2(0.0, -1.0);
+        seed_random(m_random, 0, 0);
+        VariableSet names;
+        m_ast->collect_variables(names);
+        m_uses_random = names.count(RANDOM_ROW) != 0;
+    }
+    ParsedFormula(std::shared_ptr<ProgramNode> program, Arena arena = {}) :
+        ParsedFormula(std::static_pointer_cast<Node>(program), std::move(arena))
+    {
+        m_program = program;
+        m_outputs.resize(program->outputs().size());
+    }
+    ~ParsedFormula() override
+    {
+        for (const auto &[runtime, function] : m_shared_functions)
+        {
+            runtime->release(function);
+        }
+    }
+
+    void set_value(std::string_view name, double value) override
+    {
+        m_state.symbols[std::string{name}] = value;
+        m_complex_values.erase(std::string{name});
+    }
+    double get_value(std::string_view name) const override;
+
+    double evaluate() override;
+    bool assemble() override;
+    bool compile() override;
+
+    void set_gradient_variables(std::vector<std::string> names) override
+    {
+        m_gradient_variables = std::move(names);
+        m_gradient_function = nullptr;
+    }
+    double evaluate_gradient(const double *values, double *gradient) override;
+    bool compile_gradient() override;
+
+    void set_batch_variables(std::vector<std::string> names) override
+    {
+        m_batch_variables = std::move(names);
+        reset_batch_functions();
+        m_integer_batch_function = nullptr;
+        m_complex_batch_function = nullptr;
+        m_iteration_function = nullptr;
+        m_strided_batch_function = nullptr;
+        m_selection_function = nullptr;
+    }
+    void evaluate_batch(const double *const *columns, double *results, std::size_t count) override;
+    void evaluate_batch(const float *const *columns, float *results, std::size_t count) override;
+    double reduce(Reduction reduction, const double *const *columns, std::size_t count) override;
+    double reduce(Reduction reduction, const float *const *columns, std::size_t count) override;
+    bool compile_batch() override;
+    bool compile_reduction(Reduction reduction) override;
+    void set_specialization_threshold(std::size_t calls) override
+    {
+        m_specialization_threshold = calls;
+        reset_specialization();
+    }
+    std::vector<std::string> specialized_variables() const override;
+    void evaluate_selection(const double *const *columns, const std::uint32_t *selection, std::size_t selected,
+        double *results) override;
+    void evaluate_masked(
+        const double *const *columns, const std::uint64_t *mask, std::size_t count, double *results) override;
+    bool compile_selection() override;
+    void evaluate_batch(const StridedColumn *columns, double *results, std::size_t count) override;
+    bool compile_strided_batch() override;
+
+    void set_grid_variables(std::vector<std::string> names) override
+    {
+        m_grid_variables = std::move(names);
+        m_grid_function = nullptr;
+    }
+    bool evaluate_grid(const GridAxis *axes, double *results, unsigned threads) override;
+    bool compile_grid() override;
+
+    void set_precision(Precision precision) override
+    {
+        m_precision = precision;
+        m_function = nullptr;
+        reset_batch_functions();
+    }
+
+    void set_integer_format(IntegerFormat format) override
+    {
+        m_integer_format = format;
+        m_integer_function = nullptr;
+        m_integer_batch_function = nullptr;
+    }
+    bool evaluate_integer(std::int64_t &result) override;
+    bool compile_integer() override;
+    bool evaluate_integer_batch(const std::int64_t *const *columns, std::int64_t *results, std::size_t count) override;
+    bool compile_integer_batch() override;
+
+    void set_complex_value(std::string_view name, Complex value) override
+    {
+        m_complex_values[std::string{name}] = value;
+    }
+    bool evaluate_complex(Complex &result) override;
+    bool compile_complex() override;
+    bool evaluate_complex_batch(const Complex *const *columns, Complex *results, std::size_t count) override;
+    bool compile_complex_batch() override;
+
+    void set_iteration_limits(IterationLimits limits) override
+    {
+        m_iteration_limits = limits;
+        m_iteration_function = nullptr;
+    }
+    void iterate(const double *const *columns, double *results, std::uint32_t *iterations, std::size_t count) override;
+    bool compile_iteration() override;
+
+    void set_log_file(std::FILE *file) override
+    {
+        m_logger.setFile(file);
+    }
+    void set_hot(bool hot) override
+    {
+        m_hot = hot;
+    }
+    void set_random_seed(std::uint32_t seed, std::uint32_t stream) override
+    {
+        seed_random(m_random, seed, stream);
+    }
+
+    // Variables read by the formula, leaving out those a program assigns before reading them.
+    VariableSet variables() const
+    {
+        VariableSet names;
+        m_ast->collect_variables(names);
+        names.erase(RANDOM_ROW);
+        return names;
+    }
+
+private:
+    // Random variables need rows to count, which only batch evaluation and reductions have;
+    // the other entry points print why and return NaN instead of evaluating the formula.
+    bool rejects_random(const char *entry) const
+    {
+        if (m_uses_random)
+        {
+            std::cerr << "Random variables need evaluate_batch() or reduce(), not " << entry << "()\n";
+        }
+        return m_uses_random;
+    }
+    bool init_code_holder(asmjit::CodeHolder &code);
+    template <typename Function>
+    bool finish_function(asmjit::x86::Compiler &comp, asmjit::CodeHolder &code, Function *&function, const char *what);
+    std::vector<bool> read_columns() const;
+    template <typename Registers, typename Load>
+    void bind_inputs(Registers &registers, const std::vector<bool> &reads, Load load);
+    template <typename EmitRows>
+    bool emit_row_loop(asmjit::x86::Compiler &comp, asmjit::x86::Gp row, asmjit::x86::Gp count, std::size_t step,
+        asmjit::Label done, EmitRows emit_rows, const std::function<void()> &between = {});
+    template <typename Function>
+    asmjit::Error add_function(Function *&function, asmjit::CodeHolder &code);
+    void release_function(void *function);
+    void reset_batch_functions()
+    {
+        m_batch_function = nullptr;
+        m_reduction_functions.fill(nullptr);
+        m_float_batch_function = nullptr;
+        m_float_reduction_functions.fill(nullptr);
+        reset_specialization();
+    }
+    void reset_specialization()
+    {
+        if (m_specialized_batch_function)
+        {
+            release_function(reinterpret_cast<void *>(m_specialized_batch_function));
+            m_specialized_batch_function = nullptr;
+        }
+        m_specialized_values.clear();
+        m_profiled_calls = 0;
+    }
+    void profile_values(const double *const *columns, std::size_t count);
+    template <typename Function>
+    bool compile_batch_kernel(
+        Function *&function, std::optional<Reduction> reduction, const SpecializedValues &guards = {});
+    template <typename T, typename Consumer>
+    void interpret_rows(const T *const *columns, std::size_t count, Consumer consume);
+    void interpret_grid(const GridAxis *axes, double *results, std::size_t begin, std::size_t end) const;
+    template <typename T>
+    double interpret_reduction(Reduction reduction, const T *const *columns, std::size_t count);
+    IntegerSymbols integer_symbols() const;
+    template <typename Function>
+    bool finish_integer_function(asmjit::x86::Compiler &comp, asmjit::CodeHolder &code, Function *&function);
+    ComplexSymbols complex_symbols() const;
+
+    EmitterState m_state;
+    Arena m_arena; // Owns the nodes of a fast parsed formula, must outlive them
+    std::shared_ptr<Node> m_ast;
+    std::shared_ptr<ProgramNode> m_program;
+    std::vector<double> m_outputs; // Values of the program's assigned variables
+    Function *m_function{};
+    Variables m_gradient_variables;
+    GradientFunction *m_gradient_function{};
+    Variables m_batch_variables;
+    BatchFunction *m_batch_function{};
+    std::array<BatchFunction *, 4> m_reduction_functions{}; // Indexed by Reduction
+    std::size_t m_specialization_threshold{};
+    std::vector<ValueProfile> m_value_profiles; // Indexed like the batch variables
+    std::size_t m_profiled_calls{};
+    BatchFunction *m_specialized_batch_function{}; // Returns the rows it evaluated
+    SpecializedValues m_specialized_values;
+    FloatBatchFunction *m_float_batch_function{};
+    std::array<FloatBatchFunction *, 4> m_float_reduction_functions{};
+    SelectionFunction *m_selection_function{};
+    StridedBatchFunction *m_strided_batch_function{};
+    Variables m_grid_variables;
+    GridFunction *m_grid_function{};
+    Precision m_precision{Precision::Double};
+    IntegerFormat m_integer_format;
+    IntegerFunction *m_integer_function{};
+    IntegerBatchFunction *m_integer_batch_function{};
+    ComplexSymbols m_complex_values; // Override the real symbols in complex evaluation
+    ComplexFunction *m_complex_function{};
+    ComplexBatchFunction *m_complex_batch_function{};
+    IterationLimits m_iteration_limits;
+    IterationFunction *m_iteration_function{};
+    RandomState m_random; // Read and advanced by compiled batch kernels
+    bool m_uses_random{};
+    asmjit::JitRuntime m_runtime;
+    JitMemory m_jit_memory{default_jit_memory()};
+    bool m_hot{};
+    std::vector<std::pair<asmjit::JitRuntime *, void *>> m_shared_functions; // Released on destruction
+    asmjit::FileLogger m_logger{stdout};
+};
+
+template <typename Function>
+asmjit::Error ParsedFormula::add_function(Function *&function, asmjit::CodeHolder &code)
+{
+    if (!m_jit_memory.shared)
+    {
+        return m_runtime.add(&function, &code);
+    }
+    asmjit::JitRuntime &runtime = SharedCode::instance().runtime(m_jit_memory.large_pages, m_hot);
+    const asmjit::Error err = runtime.add(&function, &code);
+    if (!err && function)
+    {
+        m_shared_functions.emplace_back(&runtime, reinterpret_cast<void *>(function));
+    }
+    return err;
+}
+
+// Ends the function, emits its data section and adds the code to the runtime; what names the
+// kind of code in the error message.
+template <typename Function>
+bool ParsedFormula::finish_function(
+    asmjit::x86::Compiler &comp, asmjit::CodeHolder &code, Function *&function, const char *what)
+{
+    comp.endFunc();
+    emit_data_section(comp, m_state);
+    comp.finalize();
+
+    if (const asmjit::Error err = add_function(function, code); err || !function)
+    {
+        std::cerr << "Failed to compile " << what << ": " << asmjit::DebugUtils::errorAsString(err) << '\n';
+        return false;
+    }
+    return true;
+}
+
+// Binds the registers load(column) returns to the batch variables the formula reads, dropping
+// the assignments of the previous rows.
+template <typename Registers, typename Load>
+void ParsedFormula::bind_inputs(Registers &registers, const std::vector<bool> &reads, Load load)
+{
+    registers.clear();
+    for (size_t i = 0; i < reads.size(); ++i)
+    {
+        if (reads[i])
+        {
+            registers[m_batch_variables[i]] = load(i);
+        }
+    }
+}
+
+// Emits the loop of the row kernels over count rows: step rows at a time with m_state.packed
+// set, then between, then one row at a time for the rest.  emit_rows() emits the body for the
+// rows from row on and returns false if the formula doesn't compile; a step of one leaves out
+// the packed loop.  done is bound after the loops, so the body may also jump there.
+template <typename EmitRows>
+bool ParsedFormula::emit_row_loop(asmjit::x86::Compiler &comp, asmjit::x86::Gp row, asmjit::x86::Gp count,
+    std::size_t step, asmjit::Label done, EmitRows emit_rows, const std::function<void()> &between)
+{
+    comp.xor_(row, row);
+    if (step > 1)
+    {
+        asmjit::x86::Gp vector_end = comp.newIntPtr("vector_end");
+        asmjit::Label vector_loop = comp.newLabel();
+        asmjit::Label vector_done = comp.newLabel();
+        comp.mov(vector_end, count);
+        comp.and_(vector_end, -static_cast<int32_t>(step));
+        m_state.packed = true;
+        comp.cmp(row, vector_end);
+        comp.jae(vector_done);
+        comp.bind(vector_loop);
+        if (!emit_rows())
+        {
+            return false;
+        }
+        comp.add(row, static_cast<int32_t>(step));
+        comp.cmp(row, vector_end);
+        comp.jb(vector_loop);
+        comp.bind(vector_done);
+    }
+    if (between)
+    {
+        between();
+    }
+
+    m_state.packed = false;
+    asmjit::Label scalar_loop = comp.newLabel();
+    comp.cmp(row, count);
+    comp.jae(done);
+    comp.bind(scalar_loop);
+    if (!emit_rows())
+    {
+        return false;
+    }
+    comp.inc(row);
+    comp.cmp(row, count);
+    comp.jb(scalar_loop);
+    comp.bind(done);
+    return true;
+}
+
+} // namespace internal
+
+} // namespace formula
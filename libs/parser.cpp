@@ -0,0 +1,432 @@
+#include "parsed_formula.h"
+
+#include <boost/parser/parser.hpp>
+
+#include <charconv>
+#include <system_error>
+
+namespace bp = boost::parser;
+
+namespace formula
+{
+
+namespace internal
+{
+
+namespace
+{
+
+const auto make_number = [](auto &ctx) { return std::make_shared<NumberNode>(bp::_attr(ctx)); };
+
+const auto make_identifier = [](auto &ctx) { return std::make_shared<IdentifierNode>(bp::_attr(ctx)); };
+
+const auto make_unary_op = [](auto &ctx)
+{ return std::make_shared<UnaryOpNode>(std::get<0>(bp::_attr(ctx)), std::get<1>(bp::_attr(ctx))); };
+
+const auto make_binary_op = [](auto &ctx)
+{
+    return std::make_shared<BinaryOpNode>(
+        std::get<0>(bp::_attr(ctx)), std::get<1>(bp::_attr(ctx)), std::get<2>(bp::_attr(ctx)));
+};
+
+const auto make_binary_op_seq = [](auto &ctx)
+{
+    auto left = std::get<0>(bp::_attr(ctx));
+    for (const auto &op : std::get<1>(bp::_attr(ctx)))
+    {
+        left = std::make_shared<BinaryOpNode>(left, std::get<0>(op), std::get<1>(op));
+    }
+    return left;
+};
+
+const auto make_power = [](auto &ctx) -> std::shared_ptr<Node>
+{
+    const auto &exponent = std::get<1>(bp::_attr(ctx));
+    if (!exponent)
+    {
+        return std::get<0>(bp::_attr(ctx));
+    }
+    return std::make_shared<PowerNode>(std::get<0>(bp::_attr(ctx)), *exponent);
+};
+
+// Calls are resolved while parsing; unknown functions and wrong argument counts fail the
+// alternative.
+const auto make_call = [](auto &ctx)
+{
+    const std::string &name = std::get<0>(bp::_attr(ctx));
+    std::vector<std::shared_ptr<Node>> arguments;
+    if (const auto &list = std::get<1>(bp::_attr(ctx)))
+    {
+        arguments = *list;
+    }
+    if (is_builtin_function(name) && arguments.empty())
+    {
+        const auto site = static_cast<std::uint32_t>(bp::_where(ctx).begin() - bp::_begin(ctx));
+        bp::_val(ctx) = std::make_shared<RandomNode>(name == "normal", site);
+        return;
+    }
+    std::shared_ptr<const UserFunction> function = FunctionRegistry::instance().find(name);
+    if (!function || function->arity != arguments.size())
+    {
+        bp::_pass(ctx) = false;
+        return;
+    }
+    bp::_val(ctx) = std::make_shared<CallNode>(std::move(function), std::move(arguments));
+};
+
+const auto make_assignment = [](auto &ctx)
+{ return Statement{std::get<0>(bp::_attr(ctx)), std::get<1>(bp::_attr(ctx))}; };
+
+const auto make_expr_statement = [](auto &ctx) { return Statement{std::string{}, bp::_attr(ctx)}; };
+
+// Terminal parsers
+const auto alpha = bp::char_('a', 'z') | bp::char_('A', 'Z');
+const auto digit = bp::char_('0', '9');
+const auto alnum = alpha | digit | bp::char_('_');
+const auto identifier = bp::lexeme[alpha >> *alnum];
+
+// Grammar rules
+bp::rule<struct NumberTag, Expr> number = "number";
+bp::rule<struct IdentifierTag, Expr> variable = "variable";
+bp::rule<struct CallTag, Expr> call = "function call";
+bp::rule<struct ExprTag, Expr> expr = "expression";
+bp::rule<struct TermTag, Expr> term = "multiplicative term";
+bp::rule<struct FactorTag, Expr> factor = "additive factor";
+bp::rule<struct PowerTag, Expr> power = "power";
+bp::rule<struct PrimaryTag, Expr> primary = "primary expression";
+bp::rule<struct UnaryOpTag, Expr> unary_op = "unary operator";
+bp::rule<struct AssignmentTag, Statement> assignment = "assignment";
+bp::rule<struct ExprStatementTag, Statement> expr_statement = "expression statement";
+bp::rule<struct StatementTag, Statement> statement = "statement";
+bp::rule<struct ProgramTag, std::vector<Statement>> program = "program";
+
+// Signs are unary operators, so -x^2 is -(x^2) for numbers as well
+const auto number_def = (&(digit | '.') >> bp::double_)[make_number];
+const auto variable_def = identifier[make_identifier];
+const auto call_def = (identifier >> '(' >> -(expr % ',') >> ')')[make_call];
+const auto unary_op_def = (bp::char_("-+") >> factor)[make_unary_op];
+const auto primary_def = number | call | variable | '(' >> expr >> ')';
+const auto power_def = (primary >> -('^' >> factor))[make_power]; // Right associative
+const auto factor_def = power | unary_op;
+const auto term_def = (factor >> *(bp::char_("*/") >> factor))[make_binary_op_seq];
+const auto expr_def = (term >> *(bp::char_("+-") >> term))[make_binary_op_seq];
+const auto assignment_def = (identifier >> '=' >> expr)[make_assignment];
+const auto expr_statement_def = expr[make_expr_statement];
+const auto statement_def = assignment | expr_statement;
+const auto program_def = statement % ';' >> -bp::lit(';');
+
+BOOST_PARSER_DEFINE_RULES(number, variable, call, expr, term, factor, power, primary, unary_op, assignment,
+    expr_statement, statement, program);
+
+// Single pass precedence climbing parser for the grammar above.  It does not throw on
+// malformed input and allocates the nodes from an arena that the formula keeps alive.
+class FastParser
+{
+public:
+    FastParser(std::string_view text, std::pmr::memory_resource *arena) :
+        m_text(text),
+        m_arena(arena)
+    {
+    }
+
+    bool parse(std::vector<Statement> &statements);
+
+    ParseError error() const
+    {
+        return {m_error_position, m_error};
+    }
+
+private:
+    template <typename T, typename... Args>
+    std::shared_ptr<T> make(Args &&...args)
+    {
+        return std::allocate_shared<T>(std::pmr::polymorphic_allocator<T>(m_arena), std::forward<Args>(args)...);
+    }
+    bool at_end()
+    {
+        skip_space();
+        return m_pos == m_text.size();
+    }
+    bool peek(char c)
+    {
+        return !at_end() && m_text[m_pos] == c;
+    }
+    Expr fail(const char *message)
+    {
+        if (!m_error)
+        {
+            m_error = message;
+            m_error_position = m_pos;
+        }
+        return {};
+    }
+    void skip_space();
+    std::string_view identifier();
+    bool statement(Statement &result);
+    Expr expression(int min_precedence);
+    Expr factor();
+    Expr primary();
+
+    std::string_view m_text;
+    std::size_t m_pos{};
+    std::pmr::memory_resource *m_arena;
+    const char *m_error{};
+    std::size_t m_error_position{};
+};
+
+int precedence(char op)
+{
+    if (op == '+' || op == '-')
+    {
+        return 1;
+    }
+    if (op == '*' || op == '/')
+    {
+        return 2;
+    }
+    return 0;
+}
+
+void FastParser::skip_space()
+{
+    while (m_pos < m_text.size() &&
+        (m_text[m_pos] == ' ' || (m_text[m_pos] >= '\t' && m_text[m_pos] <= '\r')))
+    {
+        ++m_pos;
+    }
+}
+
+std::string_view FastParser::identifier()
+{
+    skip_space();
+    const std::size_t begin = m_pos;
+    if (m_pos < m_text.size() && is_alpha(m_text[m_pos]))
+    {
+        while (++m_pos < m_text.size() && is_alnum(m_text[m_pos]))
+        {
+        }
+    }
+    return m_text.substr(begin, m_pos - begin);
+}
+
+bool FastParser::parse(std::vector<Statement> &statements)
+{
+    do
+    {
+        Statement result;
+        if (!statement(result))
+        {
+            return false;
+        }
+        statements.push_back(std::move(result));
+        if (!peek(';'))
+        {
+            break;
+        }
+        ++m_pos;
+    } while (!at_end());
+
+    if (!at_end())
+    {
+        fail("expected ';' or an operator");
+        return false;
+    }
+    return true;
+}
+
+bool FastParser::statement(Statement &result)
+{
+    // An assignment starts with an identifier followed by '='; otherwise rewind and
+    // parse an expression, like the assignment | expr_statement alternative.
+    const std::size_t start = m_pos;
+    if (const std::string_view name = identifier(); !name.empty() && peek('='))
+    {
+        ++m_pos;
+        result.name = std::string{name};
+    }
+    else
+    {
+        m_pos = start;
+    }
+    result.value = expression(1);
+    return result.value != nullptr;
+}
+
+Expr FastParser::expression(int min_precedence)
+{
+    Expr left = factor();
+    while (left && !at_end())
+    {
+        const char op = m_text[m_pos];
+        const int op_precedence = precedence(op);
+        if (op_precedence == 0 || op_precedence < min_precedence)
+        {
+            break;
+        }
+        ++m_pos;
+        Expr right = expression(op_precedence + 1);
+        if (!right)
+        {
+            return {};
+        }
+        left = make<BinaryOpNode>(left, op, right);
+    }
+    return left;
+}
+
+Expr FastParser::factor()
+{
+    if (at_end())
+    {
+        return fail("expected a number, variable, '(' or unary operator");
+    }
+
+    const char c = m_text[m_pos];
+    if (c == '+' || c == '-')
+    {
+        ++m_pos;
+        Expr operand = factor();
+        if (!operand)
+        {
+            return {};
+        }
+        return make<UnaryOpNode>(c, operand);
+    }
+    Expr base = primary();
+    if (!base || !peek('^'))
+    {
+        return base;
+    }
+    // Right associative: the exponent is again a factor, as in power_def
+    ++m_pos;
+    Expr exponent = factor();
+    if (!exponent)
+    {
+        return {};
+    }
+    return make<PowerNode>(base, exponent);
+}
+
+Expr FastParser::primary()
+{
+    const char *begin = m_text.data() + m_pos;
+    const char *end = m_text.data() + m_text.size();
+    double value{};
+    if ((*begin >= '0' && *begin <= '9') || *begin == '.')
+    {
+        if (const auto [last, ec] = std::from_chars(begin, end, value); ec == std::errc())
+        {
+            m_pos += last - begin;
+            return make<NumberNode>(value);
+        }
+    }
+    if (is_alpha(*begin))
+    {
+        const std::size_t start = m_pos;
+        const std::string_view name = identifier();
+        if (!peek('('))
+        {
+            return make<IdentifierNode>(std::string{name});
+        }
+        ++m_pos;
+        std::vector<Expr> arguments;
+        while (!peek(')'))
+        {
+            if (!arguments.empty())
+            {
+                if (!peek(','))
+                {
+                    return fail("expected ',' or ')'");
+                }
+                ++m_pos;
+            }
+            Expr argument = expression(1);
+            if (!argument)
+            {
+                return {};
+            }
+            arguments.push_back(std::move(argument));
+        }
+        ++m_pos;
+        if (is_builtin_function(name) && arguments.empty())
+        {
+            return make<RandomNode>(name == "normal", static_cast<std::uint32_t>(start));
+        }
+        std::shared_ptr<const UserFunction> function = FunctionRegistry::instance().find(name);
+        if (!function || function->arity != arguments.size())
+        {
+            m_pos = start;
+            return fail(function ? "wrong number of arguments" : "unknown function");
+        }
+        return make<CallNode>(std::move(function), std::move(arguments));
+    }
+    if (*begin == '(')
+    {
+        ++m_pos;
+        Expr result = expression(1);
+        if (!result)
+        {
+            return {};
+        }
+        if (!peek(')'))
+        {
+            return fail("expected ')'");
+        }
+        ++m_pos;
+        return result;
+    }
+    return fail("expected a number, variable, '(' or unary operator");
+}
+
+} // namespace
+
+} // namespace internal
+
+std::shared_ptr<Formula> parse(std::string_view text)
+{
+    std::vector<internal::Statement> statements;
+
+    try
+    {
+        if (auto success = bp::parse(text, internal::program, bp::ws, statements /*, bp::trace::on*/);
+            success && !statements.empty())
+        {
+            if (statements.size() == 1 && statements.front().name.empty())
+            {
+                return std::make_shared<internal::ParsedFormula>(statements.front().value);
+            }
+            return std::make_shared<internal::ParsedFormula>(
+                std::make_shared<internal::ProgramNode>(std::move(statements)));
+        }
+    }
+    catch (const bp::parse_error<std::string_view::const_iterator> &e)
+    {
+        std::cerr << "Parse error: " << e.what() << '\n';
+    }
+    return {};
+}
+
+std::shared_ptr<Formula> parse_fast(std::string_view text, ParseError *error)
+{
+    auto arena = std::make_shared<std::pmr::monotonic_buffer_resource>(256 + text.size() * 16);
+    internal::FastParser parser(text, arena.get());
+    std::vector<internal::Statement> statements;
+    if (!parser.parse(statements))
+    {
+        if (error)
+        {
+            *error = parser.error();
+        }
+        return {};
+    }
+
+    if (statements.size() == 1 && statements.front().name.empty())
+    {
+        return std::make_shared<internal::ParsedFormula>(statements.front().value, std::move(arena));
+    }
+    auto program = std::allocate_shared<internal::ProgramNode>(
+        std::pmr::polymorphic_allocator<internal::ProgramNode>(arena.get()), std::move(statements));
+    return std::make_shared<internal::ParsedFormula>(std::move(program), std::move(arena));
+}
+
+} // namespace formula
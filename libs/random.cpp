@@ -0,0 +1,86 @@
+#include "random.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace formula
+{
+
+namespace internal
+{
+
+namespace
+{
+
+template <std::size_t N>
+double horner(const std::array<double, N> &coefficients, double x)
+{
+    double result = coefficients[0];
+    for (std::size_t i = 1; i < N; ++i)
+    {
+        result = result * x + coefficients[i];
+    }
+    return result;
+}
+
+} // namespace
+
+std::uint32_t stream_word(std::uint32_t stream)
+{
+    return stream * 0x85EBCA6BU;
+}
+
+std::uint32_t site_word(std::uint32_t site)
+{
+    return site * 0xC2B2AE35U;
+}
+
+void seed_random(RandomState &random, std::uint32_t seed, std::uint32_t stream)
+{
+    random.row = 0;
+    random.seed = seed;
+    random.stream = stream;
+    random.stream_word.fill(stream_word(stream));
+    for (int round = 0; round < PHILOX_ROUNDS; ++round)
+    {
+        random.keys[round].fill(static_cast<std::uint32_t>(seed + round * PHILOX_WEYL));
+    }
+}
+
+double random_mantissa(std::uint64_t row, std::uint32_t seed, std::uint32_t stream, std::uint32_t site)
+{
+    std::uint32_t x0 = static_cast<std::uint32_t>(row);
+    std::uint32_t x1 = stream_word(stream) ^ site_word(site) ^ static_cast<std::uint32_t>(row >> 32);
+    std::uint32_t key = seed;
+    for (int round = 0; round < PHILOX_ROUNDS; ++round)
+    {
+        const std::uint64_t product = std::uint64_t{PHILOX_MULTIPLIER} * x0;
+        x0 = static_cast<std::uint32_t>(product >> 32) ^ key ^ x1;
+        x1 = static_cast<std::uint32_t>(product);
+        key += PHILOX_WEYL;
+    }
+    const std::uint64_t bits = std::uint64_t{x0} << 20 | x1 >> 12 | 0x3FF0000000000000;
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+double inverse_normal(double p)
+{
+    const double q = p - 0.5;
+    const double r = q * q;
+    const double central = horner(NORMAL_CENTRAL_NUMERATOR, r) * q / horner(NORMAL_CENTRAL_DENOMINATOR, r);
+    const double t = std::min(p, 1.0 - p);
+    const double s = std::sqrt(std::log(t) * -2.0);
+    double tail = horner(NORMAL_TAIL_NUMERATOR, s) / horner(NORMAL_TAIL_DENOMINATOR, s);
+    if (0.5 < p)
+    {
+        tail = -tail;
+    }
+    return t < NORMAL_LOW ? tail : central;
+}
+
+} // namespace internal
+
+} // namespace formula
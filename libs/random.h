@@ -0,0 +1,54 @@
+#pragma once
+
+#include "emitter.h"
+
+namespace formula
+{
+
+namespace internal
+{
+
+// Philox2x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3"): ten rounds of
+// a 32x32->64 bit multiply, which SSE2 does for two lanes with pmuludq.
+constexpr std::uint32_t PHILOX_MULTIPLIER{0xD256D193};
+constexpr std::uint32_t PHILOX_WEYL{0x9E3779B9};
+constexpr int PHILOX_ROUNDS{10};
+
+// Reserved symbols through which the interpreter passes the generator state; they can't
+// collide with variables, which are identifiers.
+constexpr char RANDOM_ROW[] = "#row";
+constexpr char RANDOM_SEED[] = "#seed";
+constexpr char RANDOM_STREAM[] = "#stream";
+
+// Words that make the second counter word differ between streams and call sites.
+std::uint32_t stream_word(std::uint32_t stream);
+
+std::uint32_t site_word(std::uint32_t site);
+
+void seed_random(RandomState &random, std::uint32_t seed, std::uint32_t stream);
+
+// The 64 output bits of the generator for a row and call site, 52 of them as the mantissa
+// of a double in [1, 2).
+double random_mantissa(std::uint64_t row, std::uint32_t seed, std::uint32_t stream, std::uint32_t site);
+
+// Subtracted from a mantissa for probabilities in (0, 1), which keeps the normal quantile finite.
+constexpr double OPEN_INTERVAL_OFFSET{1.0 - 0x1p-53};
+
+// Acklam's rational approximations of the standard normal quantile, relative error below
+// 1.2e-9: a central one and a tail one in sqrt(-2 log(min(p, 1 - p))).
+constexpr double NORMAL_LOW{0.02425};
+constexpr std::array<double, 6> NORMAL_CENTRAL_NUMERATOR{-3.969683028665376e+01, 2.209460984245205e+02,
+    -2.759285104469687e+02, 1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00};
+constexpr std::array<double, 6> NORMAL_CENTRAL_DENOMINATOR{-5.447609879822406e+01, 1.615858368580409e+02,
+    -1.556989798598866e+02, 6.680131188771972e+01, -1.328068155288572e+01, 1.0};
+constexpr std::array<double, 6> NORMAL_TAIL_NUMERATOR{-7.784894002430293e-03, -3.223964580411365e-01,
+    -2.400758277161838e+00, -2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00};
+constexpr std::array<double, 5> NORMAL_TAIL_DENOMINATOR{
+    7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00, 1.0};
+
+// Same operations as PackedMath::inverse_normal, apart from the logarithm.
+double inverse_normal(double p);
+
+} // namespace internal
+
+} // namespace formula
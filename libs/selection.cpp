@@ -0,0 +1,263 @@
+#include "parsed_formula.h"
+
+#include <bitset>
+#include <cstring>
+#include <limits>
+
+namespace formula
+{
+
+namespace internal
+{
+
+void ParsedFormula::evaluate_selection(
+    const double *const *columns, const std::uint32_t *selection, std::size_t selected, double *results)
+{
+    if (m_selection_function)
+    {
+        m_selection_function(columns, selection, selected, results);
+        return;
+    }
+    if (rejects_random("evaluate_selection"))
+    {
+        for (std::size_t i = 0; i < selected; ++i)
+        {
+            results[selection[i]] = std::numeric_limits<double>::quiet_NaN();
+        }
+        return;
+    }
+
+    SymbolTable symbols{m_state.symbols};
+    std::vector<double *> slots;
+    for (const std::string &name : m_batch_variables)
+    {
+        slots.push_back(&symbols[name]);
+    }
+    for (std::size_t i = 0; i < selected; ++i)
+    {
+        const std::uint32_t row = selection[i];
+        for (size_t j = 0; j < slots.size(); ++j)
+        {
+            *slots[j] = columns[j][row];
+        }
+        results[row] = m_ast->evaluate(symbols);
+    }
+}
+
+// The set bits are turned into a selection a block of words at a time, so the cost follows
+// the number of words and selected rows.  Rows are selected relative to the block, which keeps
+// them within 32 bits for any count.
+void ParsedFormula::evaluate_masked(
+    const double *const *columns, const std::uint64_t *mask, std::size_t count, double *results)
+{
+    constexpr std::size_t BLOCK_WORDS{64};
+    std::array<std::uint32_t, BLOCK_WORDS * 64> selection;
+    std::vector<const double *> block_columns(m_batch_variables.size());
+    const std::size_t words = (count + 63) / 64;
+    for (std::size_t first = 0; first < words; first += BLOCK_WORDS)
+    {
+        for (std::size_t i = 0; i < block_columns.size(); ++i)
+        {
+            block_columns[i] = columns[i] + first * 64;
+        }
+        std::size_t selected{};
+        for (std::size_t word = first; word < std::min(words, first + BLOCK_WORDS); ++word)
+        {
+            std::uint64_t bits = mask[word];
+            if (word == words - 1 && count % 64 != 0)
+            {
+                bits &= (std::uint64_t{1} << count % 64) - 1; // Rows past the end
+            }
+            for (; bits != 0; bits &= bits - 1)
+            {
+                const std::size_t bit = std::bitset<64>((bits & (0 - bits)) - 1).count();
+                selection[selected++] = static_cast<std::uint32_t>((word - first) * 64 + bit);
+            }
+        }
+        evaluate_selection(block_columns.data(), selection.data(), selected, results + first * 64);
+    }
+}
+
+// Gathers the inputs of two selected rows with movsd and movhpd and scatters the results the
+// same way.
+bool ParsedFormula::compile_selection()
+{
+    m_selection_function = nullptr;
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    asmjit::x86::Compiler comp(&code);
+    asmjit::x86::Gp columns;
+    asmjit::x86::Gp selection;
+    asmjit::x86::Gp selected;
+    asmjit::x86::Gp results;
+    begin_function(comp,
+        asmjit::FuncSignature::build<void, const double *const *, const std::uint32_t *, std::size_t, double *>(),
+        {{&columns, "columns"}, {&selection, "selection"}, {&selected, "selected"}, {&results, "results"}});
+
+    const std::vector<bool> reads = read_columns();
+    const std::vector<asmjit::x86::Gp> bases = load_bases(comp, columns, reads);
+    asmjit::x86::Gp position = comp.newIntPtr("position");
+    asmjit::x86::Gp first = comp.newIntPtr("first");
+    asmjit::x86::Gp second = comp.newIntPtr("second");
+    m_state.preheader = comp.cursor();
+
+    const auto emit_rows = [&]
+    {
+        comp.mov(first.r32(), asmjit::x86::dword_ptr(selection, position, 2)); // Zero extended
+        if (m_state.packed)
+        {
+            comp.mov(second.r32(), asmjit::x86::dword_ptr(selection, position, 2, 4));
+        }
+        bind_inputs(m_state.registers, reads,
+            [&](size_t column)
+            {
+                asmjit::x86::Xmm input = new_value_register(comp, m_state);
+                comp.movsd(input, asmjit::x86::ptr(bases[column], first, 3));
+                if (m_state.packed)
+                {
+                    comp.movhpd(input, asmjit::x86::ptr(bases[column], second, 3));
+                }
+                return input;
+            });
+        asmjit::x86::Xmm value = new_value_register(comp, m_state);
+        if (!m_ast->compile(comp, m_state, value))
+        {
+            return false;
+        }
+        if (m_state.packed)
+        {
+            comp.movlpd(asmjit::x86::ptr(results, first, 3), value);
+            comp.movhpd(asmjit::x86::ptr(results, second, 3), value);
+        }
+        else
+        {
+            comp.movsd(asmjit::x86::ptr(results, first, 3), value);
+        }
+        return true;
+    };
+    if (!emit_row_loop(comp, position, selected, 2, comp.newLabel(), emit_rows))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    comp.ret();
+    return finish_function(comp, code, m_selection_function, "selection formula");
+}
+
+void ParsedFormula::evaluate_batch(const StridedColumn *columns, double *results, std::size_t count)
+{
+    if (m_strided_batch_function)
+    {
+        m_strided_batch_function(columns, results, count);
+        return;
+    }
+
+    SymbolTable symbols{m_state.symbols};
+    std::vector<double *> slots;
+    for (const std::string &name : m_batch_variables)
+    {
+        slots.push_back(&symbols[name]);
+    }
+    symbols[RANDOM_SEED] = m_random.seed;
+    symbols[RANDOM_STREAM] = m_random.stream;
+    double &random_row = symbols[RANDOM_ROW];
+    for (std::size_t row = 0; row < count; ++row)
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            const char *address =
+                static_cast<const char *>(columns[i].base) + columns[i].offset + row * columns[i].stride;
+            std::memcpy(slots[i], address, sizeof(double));
+        }
+        random_row = static_cast<double>(m_random.row + row);
+        results[row] = m_ast->evaluate(symbols);
+    }
+    m_random.row += count;
+}
+
+// Each column keeps a pointer that advances by its stride; the two rows of a vector are
+// gathered with movsd and movhpd.
+bool ParsedFormula::compile_strided_batch()
+{
+    m_strided_batch_function = nullptr;
+    asmjit::CodeHolder code;
+    if (!init_code_holder(code))
+    {
+        return false;
+    }
+    asmjit::x86::Compiler comp(&code);
+    asmjit::x86::Gp columns;
+    asmjit::x86::Gp results;
+    asmjit::x86::Gp count;
+    begin_function(comp, asmjit::FuncSignature::build<void, const StridedColumn *, double *, std::size_t>(),
+        {{&columns, "columns"}, {&results, "results"}, {&count, "count"}});
+
+    const std::vector<bool> reads = read_columns();
+    std::vector<asmjit::x86::Gp> pointers;
+    std::vector<asmjit::x86::Gp> strides;
+    for (size_t i = 0; i < reads.size(); ++i)
+    {
+        pointers.push_back(comp.newIntPtr());
+        strides.push_back(comp.newIntPtr());
+        if (reads[i])
+        {
+            const auto field = [&](size_t offset)
+            { return asmjit::x86::qword_ptr(columns, static_cast<int32_t>(i * sizeof(StridedColumn) + offset)); };
+            comp.mov(pointers[i], field(offsetof(StridedColumn, base)));
+            comp.add(pointers[i], field(offsetof(StridedColumn, offset)));
+            comp.mov(strides[i], field(offsetof(StridedColumn, stride)));
+        }
+    }
+    asmjit::x86::Gp row = comp.newIntPtr("row");
+    m_state.random = RandomRegisters{&m_random, row};
+    m_state.preheader = comp.cursor();
+
+    const auto emit_rows = [&]
+    {
+        bind_inputs(m_state.registers, reads,
+            [&](size_t column)
+            {
+                asmjit::x86::Xmm input = new_value_register(comp, m_state);
+                comp.movsd(input, asmjit::x86::ptr(pointers[column]));
+                comp.add(pointers[column], strides[column]);
+                if (m_state.packed)
+                {
+                    comp.movhpd(input, asmjit::x86::ptr(pointers[column]));
+                    comp.add(pointers[column], strides[column]);
+                }
+                return input;
+            });
+        asmjit::x86::Xmm value = new_value_register(comp, m_state);
+        if (!m_ast->compile(comp, m_state, value))
+        {
+            return false;
+        }
+        if (m_state.packed)
+        {
+            comp.movupd(asmjit::x86::ptr(results, row, 3), value);
+        }
+        else
+        {
+            comp.movsd(asmjit::x86::ptr(results, row, 3), value);
+        }
+        return true;
+    };
+    if (!emit_row_loop(comp, row, count, 2, comp.newLabel(), emit_rows))
+    {
+        std::cerr << "Failed to compile AST\n";
+        return false;
+    }
+    if (m_state.random->used)
+    {
+        comp.add(asmjit::x86::qword_ptr(m_state.random->address, offsetof(RandomState, row)), row);
+    }
+    comp.ret();
+    return finish_function(comp, code, m_strided_batch_function, "strided batch formula");
+}
+
+} // namespace internal
+
+} // namespace formula
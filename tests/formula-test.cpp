@@ -1,8 +1,32 @@
 #include <formula/formula.h>
+#include <formula/inline_function.h>
+#include <formula/static_formula.h>
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+// Fixtures that run each test through the interpreter and, with the parameter set, the
+// compiled code.
+using ModeTest = testing::TestWithParam<bool>;
+
+std::string mode_name(const testing::TestParamInfo<bool> &info)
+{
+    return info.param ? "compiled" : "interpreted";
+}
+
+} // namespace
 
 TEST(TestFormulaParse, constant)
 {
@@ -90,6 +114,18 @@ TEST(TestFormulaParse, invalidIdentifier)
     EXPECT_FALSE(formula::parse("_a"));
 }
 
+TEST(TestFormulaParse, randomCalls)
+{
+    EXPECT_TRUE(formula::parse("rand() + normal ( )"));
+    EXPECT_TRUE(formula::parse("rand"));
+    EXPECT_FALSE(formula::parse("foo()"));
+    EXPECT_FALSE(formula::parse("rand("));
+    EXPECT_TRUE(formula::parse_fast("rand() + normal ( )"));
+    EXPECT_TRUE(formula::parse_fast("rand"));
+    EXPECT_FALSE(formula::parse_fast("foo()"));
+    EXPECT_FALSE(formula::parse_fast("rand("));
+}
+
 TEST(TestFormulaEvaluate, one)
 {
     ASSERT_EQ(1.0, formula::parse("1")->evaluate());
@@ -411,3 +447,1764 @@ TEST(TestCompiledFormulaEvaluate, addMulAdd)
 
     ASSERT_NEAR(12.76, formula->evaluate(), 1e-6);
 }
+
+TEST(TestFormulaGradient, constant)
+{
+    const auto formula{formula::parse("2")};
+    ASSERT_TRUE(formula);
+    formula->set_gradient_variables({"x"});
+    const double values[1]{3.0};
+    double gradient[1]{-1.0};
+
+    ASSERT_EQ(2.0, formula->evaluate_gradient(values, gradient));
+    ASSERT_EQ(0.0, gradient[0]);
+}
+
+TEST(TestFormulaGradient, polynomial)
+{
+    const auto formula{formula::parse("x*x*y - 3*y + 1")};
+    ASSERT_TRUE(formula);
+    formula->set_gradient_variables({"x", "y"});
+    const double values[2]{2.0, 5.0};
+    double gradient[2]{};
+
+    ASSERT_NEAR(6.0, formula->evaluate_gradient(values, gradient), 1e-12);
+    ASSERT_NEAR(20.0, gradient[0], 1e-12);
+    ASSERT_NEAR(1.0, gradient[1], 1e-12);
+}
+
+TEST(TestFormulaGradient, quotient)
+{
+    const auto formula{formula::parse("-x/(y+1)")};
+    ASSERT_TRUE(formula);
+    formula->set_gradient_variables({"x", "y"});
+    const double values[2]{3.0, 1.0};
+    double gradient[2]{};
+
+    ASSERT_NEAR(-1.5, formula->evaluate_gradient(values, gradient), 1e-12);
+    ASSERT_NEAR(-0.5, gradient[0], 1e-12);
+    ASSERT_NEAR(0.75, gradient[1], 1e-12);
+}
+
+TEST(TestCompiledFormulaGradient, polynomial)
+{
+    const auto formula{formula::parse("x*x*y - 3*y + 1")};
+    ASSERT_TRUE(formula);
+    formula->set_gradient_variables({"x", "y"});
+    ASSERT_TRUE(formula->compile_gradient());
+    const double values[2]{2.0, 5.0};
+    double gradient[2]{};
+
+    ASSERT_NEAR(6.0, formula->evaluate_gradient(values, gradient), 1e-12);
+    ASSERT_NEAR(20.0, gradient[0], 1e-12);
+    ASSERT_NEAR(1.0, gradient[1], 1e-12);
+}
+
+TEST(TestCompiledFormulaGradient, quotient)
+{
+    const auto formula{formula::parse("-x/(y+1)")};
+    ASSERT_TRUE(formula);
+    formula->set_gradient_variables({"x", "y"});
+    ASSERT_TRUE(formula->compile_gradient());
+    const double values[2]{3.0, 1.0};
+    double gradient[2]{};
+
+    ASSERT_NEAR(-1.5, formula->evaluate_gradient(values, gradient), 1e-12);
+    ASSERT_NEAR(-0.5, gradient[0], 1e-12);
+    ASSERT_NEAR(0.75, gradient[1], 1e-12);
+}
+
+TEST(TestCompiledFormulaGradient, symbolsAreConstant)
+{
+    const auto formula{formula::parse("a*x")};
+    ASSERT_TRUE(formula);
+    formula->set_value("a", 4.0);
+    formula->set_gradient_variables({"x"});
+    ASSERT_TRUE(formula->compile_gradient());
+    const double values[1]{0.5};
+    double gradient[1]{};
+
+    ASSERT_NEAR(2.0, formula->evaluate_gradient(values, gradient), 1e-12);
+    ASSERT_NEAR(4.0, gradient[0], 1e-12);
+}
+
+TEST(TestFormulaParse, assignment)
+{
+    ASSERT_TRUE(formula::parse("a = 1"));
+}
+
+TEST(TestFormulaParse, statements)
+{
+    ASSERT_TRUE(formula::parse("t = a*b; u = t + c; out1 = t/u; out2 = u*u"));
+}
+
+TEST(TestFormulaParse, trailingSemicolon)
+{
+    ASSERT_TRUE(formula::parse("t = 2; t*t;"));
+}
+
+TEST(TestFormulaParse, invalidAssignment)
+{
+    EXPECT_FALSE(formula::parse("1 = a"));
+    EXPECT_FALSE(formula::parse("a = "));
+    EXPECT_FALSE(formula::parse("a = 1;; b = 2"));
+}
+
+TEST(TestFormulaEvaluate, statements)
+{
+    const auto formula{formula::parse("t = a*b; u = t + c; out1 = t/u; out2 = u*u")};
+    ASSERT_TRUE(formula);
+    formula->set_value("a", 2.0);
+    formula->set_value("b", 3.0);
+    formula->set_value("c", 4.0);
+
+    ASSERT_NEAR(100.0, formula->evaluate(), 1e-12);
+    ASSERT_NEAR(6.0, formula->get_value("t"), 1e-12);
+    ASSERT_NEAR(10.0, formula->get_value("u"), 1e-12);
+    ASSERT_NEAR(0.6, formula->get_value("out1"), 1e-12);
+    ASSERT_NEAR(100.0, formula->get_value("out2"), 1e-12);
+    ASSERT_EQ(2.0, formula->get_value("a"));
+}
+
+TEST(TestFormulaEvaluate, reassignment)
+{
+    const auto formula{formula::parse("x = x + 1; x = x * 2")};
+    ASSERT_TRUE(formula);
+    formula->set_value("x", 1.0);
+
+    ASSERT_EQ(4.0, formula->evaluate());
+    ASSERT_EQ(4.0, formula->get_value("x"));
+    ASSERT_EQ(4.0, formula->evaluate());
+}
+
+TEST(TestAssembledFormulaEvaluate, assignmentNotSupported)
+{
+    const auto formula{formula::parse("t = 1; t + 1")};
+    ASSERT_TRUE(formula);
+
+    ASSERT_FALSE(formula->assemble());
+}
+
+TEST(TestCompiledFormulaEvaluate, statements)
+{
+    const auto formula{formula::parse("t = a*b; u = t + c; out1 = t/u; out2 = u*u")};
+    ASSERT_TRUE(formula);
+    formula->set_value("a", 2.0);
+    formula->set_value("b", 3.0);
+    formula->set_value("c", 4.0);
+    ASSERT_TRUE(formula->compile());
+
+    ASSERT_NEAR(100.0, formula->evaluate(), 1e-12);
+    ASSERT_NEAR(6.0, formula->get_value("t"), 1e-12);
+    ASSERT_NEAR(10.0, formula->get_value("u"), 1e-12);
+    ASSERT_NEAR(0.6, formula->get_value("out1"), 1e-12);
+    ASSERT_NEAR(100.0, formula->get_value("out2"), 1e-12);
+}
+
+TEST(TestCompiledFormulaEvaluate, reassignment)
+{
+    const auto formula{formula::parse("x = x + 1; x = x * 2")};
+    ASSERT_TRUE(formula);
+    formula->set_value("x", 1.0);
+    ASSERT_TRUE(formula->compile());
+
+    ASSERT_EQ(4.0, formula->evaluate());
+    ASSERT_EQ(4.0, formula->get_value("x"));
+    ASSERT_EQ(4.0, formula->evaluate());
+}
+
+namespace
+{
+
+TEST(TestFormulaParseFast, expressions)
+{
+    EXPECT_TRUE(formula::parse_fast("1*(2+4)"));
+    EXPECT_TRUE(formula::parse_fast("-a_1 + +2.5e3 / (b - -1)"));
+    EXPECT_TRUE(formula::parse_fast("x = 2; y = x*x; y + 1;"));
+}
+
+TEST(TestFormulaParseFast, invalid)
+{
+    formula::ParseError error;
+    EXPECT_FALSE(formula::parse_fast("1a", &error));
+    EXPECT_EQ(1U, error.position);
+    EXPECT_NE(nullptr, error.message);
+    EXPECT_FALSE(formula::parse_fast("_a"));
+    EXPECT_FALSE(formula::parse_fast("(1 + 2", &error));
+    EXPECT_EQ(6U, error.position);
+    EXPECT_FALSE(formula::parse_fast("a = 1;; b = 2"));
+    EXPECT_FALSE(formula::parse_fast(""));
+}
+
+TEST(TestFormulaParseFast, matchesParse)
+{
+    for (const char *text :
+        {"1+2*3-4/5", "-(1+2)*3", "a*a + b*b", "2*pi", "1e-3 * x - -y", "x = a + 1; x * b", "-a^b^-x + .5^2"})
+    {
+        const auto expected{formula::parse(text)};
+        const auto actual{formula::parse_fast(text)};
+        ASSERT_TRUE(expected);
+        ASSERT_TRUE(actual);
+        for (const auto &result : {expected, actual})
+        {
+            result->set_value("a", 3.0);
+            result->set_value("b", 4.0);
+            result->set_value("x", 0.5);
+            result->set_value("y", -2.0);
+        }
+
+        EXPECT_EQ(expected->evaluate(), actual->evaluate()) << text;
+    }
+}
+
+TEST(TestCompiledFormulaEvaluate, parseFast)
+{
+    const auto formula{formula::parse_fast("x = a + 1; x * b")};
+    ASSERT_TRUE(formula);
+    formula->set_value("a", 2.0);
+    formula->set_value("b", 5.0);
+
+    ASSERT_TRUE(formula->compile());
+
+    EXPECT_EQ(15.0, formula->evaluate());
+}
+
+class TestFormulaBatch : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        for (int i = 0; i < 11; ++i)
+        {
+            price.push_back(1.5 + i);
+            qty.push_back(10.0 - 2 * i);
+        }
+        columns[0] = price.data();
+        columns[1] = qty.data();
+        formula = formula::parse("price*qty");
+        ASSERT_TRUE(formula);
+        formula->set_batch_variables({"price", "qty"});
+    }
+
+    double expected(formula::Reduction reduction) const
+    {
+        double sum{};
+        double min{price[0] * qty[0]};
+        double max{min};
+        for (size_t i = 0; i < price.size(); ++i)
+        {
+            const double value = price[i] * qty[i];
+            sum += value;
+            min = std::min(min, value);
+            max = std::max(max, value);
+        }
+        switch (reduction)
+        {
+        case formula::Reduction::Sum:
+            return sum;
+        case formula::Reduction::Min:
+            return min;
+        case formula::Reduction::Max:
+            return max;
+        case formula::Reduction::Mean:
+            return sum / static_cast<double>(price.size());
+        }
+        return 0.0;
+    }
+
+    std::vector<double> price;
+    std::vector<double> qty;
+    const double *columns[2]{};
+    std::shared_ptr<formula::Formula> formula;
+};
+
+} // namespace
+
+TEST_F(TestFormulaBatch, evaluateBatch)
+{
+    std::vector<double> results(price.size());
+
+    formula->evaluate_batch(columns, results.data(), price.size());
+
+    for (size_t i = 0; i < price.size(); ++i)
+    {
+        EXPECT_EQ(price[i] * qty[i], results[i]);
+    }
+}
+
+TEST_F(TestFormulaBatch, reduce)
+{
+    for (formula::Reduction reduction :
+        {formula::Reduction::Sum, formula::Reduction::Min, formula::Reduction::Max, formula::Reduction::Mean})
+    {
+        EXPECT_NEAR(expected(reduction), formula->reduce(reduction, columns, price.size()), 1e-9);
+    }
+}
+
+TEST_F(TestFormulaBatch, compiledBatch)
+{
+    ASSERT_TRUE(formula->compile_batch());
+    std::vector<double> results(price.size());
+
+    formula->evaluate_batch(columns, results.data(), price.size());
+
+    for (size_t i = 0; i < price.size(); ++i)
+    {
+        EXPECT_EQ(price[i] * qty[i], results[i]);
+    }
+}
+
+TEST_F(TestFormulaBatch, compiledReduce)
+{
+    for (formula::Reduction reduction :
+        {formula::Reduction::Sum, formula::Reduction::Min, formula::Reduction::Max, formula::Reduction::Mean})
+    {
+        ASSERT_TRUE(formula->compile_reduction(reduction));
+        EXPECT_NEAR(expected(reduction), formula->reduce(reduction, columns, price.size()), 1e-9);
+    }
+}
+
+TEST_F(TestFormulaBatch, compiledReduceTailOnly)
+{
+    ASSERT_TRUE(formula->compile_reduction(formula::Reduction::Sum));
+
+    EXPECT_EQ(price[0] * qty[0] + price[1] * qty[1], formula->reduce(formula::Reduction::Sum, columns, 2));
+    EXPECT_EQ(0.0, formula->reduce(formula::Reduction::Sum, columns, 0));
+}
+
+TEST_F(TestFormulaBatch, compiledReduceProgram)
+{
+    const auto program{formula::parse("t = price*qty; t + k")};
+    ASSERT_TRUE(program);
+    program->set_value("k", 1.0);
+    program->set_batch_variables({"price", "qty"});
+    ASSERT_TRUE(program->compile_reduction(formula::Reduction::Sum));
+
+    EXPECT_NEAR(expected(formula::Reduction::Sum) + static_cast<double>(price.size()),
+        program->reduce(formula::Reduction::Sum, columns, price.size()), 1e-9);
+}
+
+TEST_F(TestFormulaBatch, compiledReduceShadowedSymbol)
+{
+    const auto program{formula::parse("y = k; k = price; k*qty + y")};
+    ASSERT_TRUE(program);
+    program->set_value("k", 1.0);
+    program->set_batch_variables({"price", "qty"});
+    ASSERT_TRUE(program->compile_reduction(formula::Reduction::Sum));
+
+    EXPECT_NEAR(expected(formula::Reduction::Sum) + static_cast<double>(price.size()),
+        program->reduce(formula::Reduction::Sum, columns, price.size()), 1e-9);
+}
+
+TEST_F(TestFormulaBatch, compiledPower)
+{
+    formula = formula::parse("price^1.5 - qty^2");
+    ASSERT_TRUE(formula);
+    formula->set_batch_variables({"price", "qty"});
+    ASSERT_TRUE(formula->compile_batch());
+    std::vector<double> results(price.size());
+
+    formula->evaluate_batch(columns, results.data(), price.size());
+
+    for (size_t i = 0; i < price.size(); ++i)
+    {
+        const double expected = std::pow(price[i], 1.5) - qty[i] * qty[i];
+        EXPECT_NEAR(expected, results[i], std::abs(expected) * 1e-13);
+    }
+}
+
+namespace
+{
+
+struct Record
+{
+    double price;
+    std::int64_t id;
+    double qty;
+};
+
+} // namespace
+
+TEST_F(TestFormulaBatch, stridedColumns)
+{
+    std::vector<Record> records;
+    for (size_t i = 0; i < price.size(); ++i)
+    {
+        records.push_back({price[i], static_cast<std::int64_t>(i), qty[i]});
+    }
+    const double fee{0.25};
+    const formula::StridedColumn strided[]{{records.data(), offsetof(Record, price), sizeof(Record)},
+        {records.data(), offsetof(Record, qty), sizeof(Record)}, {&fee, 0, 0}};
+    formula = formula::parse("price*qty + fee");
+    ASSERT_TRUE(formula);
+    formula->set_batch_variables({"price", "qty", "fee"});
+
+    for (const bool compiled : {false, true})
+    {
+        if (compiled)
+        {
+            ASSERT_TRUE(formula->compile_strided_batch());
+        }
+        for (const size_t count : {price.size(), price.size() - 1})
+        {
+            std::vector<double> results(count);
+
+            formula->evaluate_batch(strided, results.data(), count);
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                EXPECT_EQ(price[i] * qty[i] + fee, results[i]);
+            }
+        }
+    }
+}
+
+TEST_F(TestFormulaBatch, selectedRows)
+{
+    const std::uint32_t selection[]{10, 3, 4, 0, 7};
+    const std::uint64_t mask[]{0x1000 | 0x60d}; // Bit 12 is past the last row
+    const std::vector<size_t> masked{0, 2, 3, 9, 10};
+
+    for (const bool compiled : {false, true})
+    {
+        if (compiled)
+        {
+            ASSERT_TRUE(formula->compile_selection());
+        }
+        std::vector<double> results(price.size(), -1.0);
+        formula->evaluate_selection(columns, selection, 5, results.data());
+        for (size_t i = 0; i < price.size(); ++i)
+        {
+            const bool selected = std::find(std::begin(selection), std::end(selection), i) != std::end(selection);
+            EXPECT_EQ(selected ? price[i] * qty[i] : -1.0, results[i]) << i;
+        }
+
+        std::fill(results.begin(), results.end(), -1.0);
+        formula->evaluate_masked(columns, mask, price.size(), results.data());
+        for (size_t i = 0; i < price.size(); ++i)
+        {
+            const bool selected = std::find(masked.begin(), masked.end(), i) != masked.end();
+            EXPECT_EQ(selected ? price[i] * qty[i] : -1.0, results[i]) << i;
+        }
+    }
+}
+
+TEST_F(TestFormulaBatch, maskedBlocks)
+{
+    // Rows past the first block of 4096 are selected relative to their block
+    constexpr std::size_t count{10000};
+    std::vector<double> x(count);
+    std::vector<double> y(count, 2.0);
+    std::vector<std::uint64_t> mask((count + 63) / 64, 0x9249249249249249); // Every third row
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        x[i] = static_cast<double>(i);
+    }
+    const double *blocks[]{x.data(), y.data()};
+
+    for (const bool compiled : {false, true})
+    {
+        if (compiled)
+        {
+            ASSERT_TRUE(formula->compile_selection());
+        }
+        std::vector<double> results(count, -1.0);
+        formula->evaluate_masked(blocks, mask.data(), count, results.data());
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            ASSERT_EQ(i % 64 % 3 == 0 ? 2.0 * i : -1.0, results[i]) << i;
+        }
+    }
+}
+
+TEST_F(TestFormulaBatch, compiledConstants)
+{
+    const auto constants{formula::parse("price*0.5 - 1 + 0*qty + -1*2.75 + 1")};
+    ASSERT_TRUE(constants);
+    constants->set_batch_variables({"price", "qty"});
+    ASSERT_TRUE(constants->compile_batch());
+    std::vector<double> results(price.size());
+
+    constants->evaluate_batch(columns, results.data(), price.size());
+
+    for (size_t i = 0; i < price.size(); ++i)
+    {
+        EXPECT_EQ(price[i] * 0.5 - 2.75, results[i]);
+    }
+}
+
+TEST_F(TestFormulaBatch, specializeStableValues)
+{
+    const auto specialized{formula::parse("r = 1 + rate; qty = qty*r; price*qty - fee")};
+    ASSERT_TRUE(specialized);
+    specialized->set_batch_variables({"price", "qty", "rate", "fee"});
+    ASSERT_TRUE(specialized->compile_batch());
+    specialized->set_specialization_threshold(3);
+    std::vector<double> rate(price.size(), 0.25);
+    std::vector<double> fee(price.size(), 1.5);
+    const double *inputs[]{price.data(), qty.data(), rate.data(), fee.data()};
+    std::vector<double> results(price.size());
+    const auto check = [&]
+    {
+        specialized->evaluate_batch(inputs, results.data(), price.size());
+        for (size_t i = 0; i < price.size(); ++i)
+        {
+            EXPECT_EQ(price[i] * (qty[i] * (1 + rate[i])) - fee[i], results[i]) << i;
+        }
+    };
+
+    for (int call = 0; call < 3; ++call)
+    {
+        EXPECT_TRUE(specialized->specialized_variables().empty());
+        check();
+    }
+    EXPECT_EQ((std::vector<std::string>{"rate", "fee"}), specialized->specialized_variables());
+    check();
+
+    fee[4] = 2.0;
+    check();
+    EXPECT_TRUE(specialized->specialized_variables().empty());
+    for (int call = 0; call < 3; ++call)
+    {
+        check();
+    }
+    EXPECT_EQ(std::vector<std::string>{"rate"}, specialized->specialized_variables());
+}
+
+TEST(TestCompiledFormulaEvaluate, sharedConstants)
+{
+    const auto first{formula::parse("x*2.75 + 0.5")};
+    const auto second{formula::parse("(x + 2.75)*-1 + 0 + unknown")};
+    ASSERT_TRUE(first);
+    ASSERT_TRUE(second);
+    first->set_value("x", 2.0);
+    second->set_value("x", 2.0);
+    second->set_precision(formula::Precision::Single);
+    ASSERT_TRUE(first->compile());
+    ASSERT_TRUE(second->compile());
+
+    EXPECT_EQ(6.0, first->evaluate());
+    EXPECT_EQ(-4.75, second->evaluate());
+}
+
+TEST(TestCompiledFormulaEvaluate, sharedJitMemory)
+{
+    formula::set_jit_memory({true, true});
+    const auto hot{formula::parse("x*2.75 + 0.5")};
+    const auto cold{formula::parse("x - 1")};
+    formula::set_jit_memory({});
+    ASSERT_TRUE(hot);
+    ASSERT_TRUE(cold);
+    hot->set_value("x", 2.0);
+    cold->set_value("x", 2.0);
+    hot->set_hot(true);
+    ASSERT_TRUE(hot->compile());
+    ASSERT_TRUE(cold->compile());
+
+    EXPECT_EQ(6.0, hot->evaluate());
+    EXPECT_EQ(1.0, cold->evaluate());
+}
+
+TEST(TestCompiledFormulaEvaluate, singlePrecision)
+{
+    const auto formula{formula::parse("1.1+2.2*3.3+4.4")};
+    ASSERT_TRUE(formula);
+    formula->set_precision(formula::Precision::Single);
+    ASSERT_TRUE(formula->compile());
+
+    ASSERT_NEAR(12.76, formula->evaluate(), 1e-5);
+}
+
+TEST(TestCompiledFormulaEvaluate, singlePrecisionStatements)
+{
+    const auto formula{formula::parse("t = a*b; u = t + 0.5")};
+    ASSERT_TRUE(formula);
+    formula->set_value("a", 2.0);
+    formula->set_value("b", 3.0);
+    formula->set_precision(formula::Precision::Single);
+    ASSERT_TRUE(formula->compile());
+
+    ASSERT_EQ(6.5, formula->evaluate());
+    ASSERT_EQ(6.0, formula->get_value("t"));
+}
+
+TEST(TestFormulaEvaluate, power)
+{
+    const auto formula{formula::parse("2^3^2 + -2^2 + (-2)^3 + 2^-2 + 4^0.5")};
+    ASSERT_TRUE(formula);
+
+    EXPECT_EQ(512.0 - 4.0 - 8.0 + 0.25 + 2.0, formula->evaluate());
+}
+
+TEST(TestFormulaEvaluate, powerLargeIntegerExponent)
+{
+    const auto formula{formula::parse("x^1073741824")};
+    ASSERT_TRUE(formula);
+    formula->set_value("x", 1.0000000123);
+
+    EXPECT_EQ(std::pow(1.0000000123, 1073741824.0), formula->evaluate());
+}
+
+TEST(TestCompiledFormulaEvaluate, powerIntegerExponent)
+{
+    const auto formula{formula::parse("x^15 - x^-3 + x^0 + x^1 + x^-1 + x^191")};
+    ASSERT_TRUE(formula);
+    formula->set_value("x", 1.01);
+    const double expected = formula->evaluate();
+    ASSERT_TRUE(formula->compile());
+
+    EXPECT_EQ(expected, formula->evaluate());
+}
+
+TEST(TestCompiledFormulaEvaluate, powerGeneralExponent)
+{
+    const auto formula{formula::parse("x^y")};
+    ASSERT_TRUE(formula);
+    ASSERT_TRUE(formula->compile());
+    const double cases[][2]{{2.0, 0.5}, {10.0, -3.25}, {0.001, 1.75}, {1e100, 3.0}, {7.5, 0.0}, {-2.0, 3.0},
+        {-2.0, 4.0}, {0.0, 2.5}, {3.0, 200.0}, {0.5, 1000.5}};
+    for (const auto &[x, y] : cases)
+    {
+        formula->set_value("x", x);
+        formula->set_value("y", y);
+        const double expected = std::pow(x, y);
+
+        EXPECT_NEAR(expected, formula->evaluate(), std::abs(expected) * 1e-12) << x << '^' << y;
+    }
+    formula->set_value("x", -2.0);
+    formula->set_value("y", 0.5);
+    EXPECT_TRUE(std::isnan(formula->evaluate()));
+    formula->set_value("x", 0.0);
+    formula->set_value("y", -1.5);
+    EXPECT_EQ(std::numeric_limits<double>::infinity(), formula->evaluate());
+}
+
+TEST(TestCompiledFormulaEvaluate, singlePrecisionPower)
+{
+    const auto formula{formula::parse("x^3 + x^1.5")};
+    ASSERT_TRUE(formula);
+    formula->set_value("x", 2.25);
+    formula->set_precision(formula::Precision::Single);
+    ASSERT_TRUE(formula->compile());
+
+    EXPECT_NEAR(2.25 * 2.25 * 2.25 + 3.375, formula->evaluate(), 1e-5);
+}
+
+TEST(TestFormulaGradient, power)
+{
+    const auto formula{formula::parse("x^3 + y^x + x^y")};
+    ASSERT_TRUE(formula);
+    formula->set_gradient_variables({"x", "y"});
+    const double values[2]{2.0, 3.0};
+    double gradient[2]{};
+
+    ASSERT_NEAR(25.0, formula->evaluate_gradient(values, gradient), 1e-12);
+    ASSERT_NEAR(12.0 + 9.0 * std::log(3.0) + 12.0, gradient[0], 1e-12);
+    ASSERT_NEAR(6.0 + 8.0 * std::log(2.0), gradient[1], 1e-12);
+}
+
+TEST(TestCompiledFormulaGradient, power)
+{
+    const auto formula{formula::parse("x^3 + y^x + x^y")};
+    ASSERT_TRUE(formula);
+    formula->set_gradient_variables({"x", "y"});
+    ASSERT_TRUE(formula->compile_gradient());
+    const double values[2]{2.0, 3.0};
+    double gradient[2]{};
+
+    ASSERT_NEAR(25.0, formula->evaluate_gradient(values, gradient), 1e-12);
+    ASSERT_NEAR(12.0 + 9.0 * std::log(3.0) + 12.0, gradient[0], 1e-12);
+    ASSERT_NEAR(6.0 + 8.0 * std::log(2.0), gradient[1], 1e-12);
+}
+
+namespace
+{
+
+class TestFormulaFloatBatch : public testing::TestWithParam<formula::Precision>
+{
+protected:
+    void SetUp() override
+    {
+        for (int i = 0; i < 19; ++i)
+        {
+            price.push_back(0.5f + static_cast<float>(i));
+            qty.push_back(20.0f - static_cast<float>(i));
+        }
+        columns[0] = price.data();
+        columns[1] = qty.data();
+        formula = formula::parse("price*qty + 1");
+        ASSERT_TRUE(formula);
+        formula->set_batch_variables({"price", "qty"});
+        formula->set_precision(GetParam());
+    }
+
+    std::vector<float> price;
+    std::vector<float> qty;
+    const float *columns[2]{};
+    std::shared_ptr<formula::Formula> formula;
+};
+
+} // namespace
+
+TEST_P(TestFormulaFloatBatch, evaluateBatch)
+{
+    std::vector<float> results(price.size());
+
+    formula->evaluate_batch(columns, results.data(), price.size());
+
+    for (size_t i = 0; i < price.size(); ++i)
+    {
+        EXPECT_EQ(price[i] * qty[i] + 1.0f, results[i]);
+    }
+}
+
+TEST_P(TestFormulaFloatBatch, compiledBatch)
+{
+    ASSERT_TRUE(formula->compile_batch());
+    std::vector<float> results(price.size());
+
+    formula->evaluate_batch(columns, results.data(), price.size());
+
+    for (size_t i = 0; i < price.size(); ++i)
+    {
+        EXPECT_EQ(price[i] * qty[i] + 1.0f, results[i]);
+    }
+}
+
+TEST_P(TestFormulaFloatBatch, compiledReduce)
+{
+    double sum{};
+    double max{-1.0};
+    for (size_t i = 0; i < price.size(); ++i)
+    {
+        sum += price[i] * qty[i] + 1.0f;
+        max = std::max(max, static_cast<double>(price[i] * qty[i] + 1.0f));
+    }
+    ASSERT_TRUE(formula->compile_reduction(formula::Reduction::Sum));
+    ASSERT_TRUE(formula->compile_reduction(formula::Reduction::Max));
+    ASSERT_TRUE(formula->compile_reduction(formula::Reduction::Mean));
+
+    EXPECT_NEAR(sum, formula->reduce(formula::Reduction::Sum, columns, price.size()), 1e-3);
+    EXPECT_EQ(max, formula->reduce(formula::Reduction::Max, columns, price.size()));
+    EXPECT_NEAR(
+        sum / static_cast<double>(price.size()), formula->reduce(formula::Reduction::Mean, columns, price.size()), 1e-3);
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Precisions, TestFormulaFloatBatch, testing::Values(formula::Precision::Single, formula::Precision::Mixed));
+
+namespace
+{
+
+class TestFormulaInteger : public ModeTest
+{
+protected:
+    bool evaluate(const char *text, formula::IntegerFormat format, std::int64_t &result)
+    {
+        formula = formula::parse(text);
+        EXPECT_TRUE(formula);
+        formula->set_value("a", 7.0);
+        formula->set_value("b", -3.0);
+        formula->set_integer_format(format);
+        if (GetParam())
+        {
+            EXPECT_TRUE(formula->compile_integer());
+        }
+        return formula->evaluate_integer(result);
+    }
+
+    std::shared_ptr<formula::Formula> formula;
+};
+
+} // namespace
+
+TEST_P(TestFormulaInteger, arithmetic)
+{
+    std::int64_t result{};
+
+    ASSERT_TRUE(evaluate("a*b + 100 - -a", {}, result));
+    EXPECT_EQ(86, result);
+    ASSERT_TRUE(evaluate("a/b", {}, result));
+    EXPECT_EQ(-2, result);
+    ASSERT_TRUE(evaluate("t = a*a; t/-1", {}, result));
+    EXPECT_EQ(-49, result);
+}
+
+TEST_P(TestFormulaInteger, fixedPoint)
+{
+    std::int64_t result{};
+
+    ASSERT_TRUE(evaluate("1.5*2.5", {16}, result));
+    EXPECT_EQ(245760, result); // 3.75 * 2^16
+    ASSERT_TRUE(evaluate("a/2", {16}, result));
+    EXPECT_EQ(229376, result); // 3.5 * 2^16
+    ASSERT_TRUE(evaluate("b*0.25", {8}, result));
+    EXPECT_EQ(-192, result); // -0.75 * 2^8
+}
+
+TEST_P(TestFormulaInteger, overflowWraps)
+{
+    std::int64_t result{};
+
+    ASSERT_TRUE(evaluate("4611686018427387904 * 2", {0, false}, result));
+    EXPECT_EQ(std::numeric_limits<std::int64_t>::min(), result);
+}
+
+TEST_P(TestFormulaInteger, checkedOverflow)
+{
+    std::int64_t result{};
+
+    EXPECT_TRUE(evaluate("(4611686018427387904 - 1) * 2 + 1", {0, true}, result));
+    EXPECT_EQ(std::numeric_limits<std::int64_t>::max(), result);
+    EXPECT_FALSE(evaluate("(4611686018427387904 - 1) * 2 + 2", {0, true}, result));
+    EXPECT_FALSE(evaluate("4611686018427387904 * 2", {0, true}, result));
+    EXPECT_FALSE(evaluate("-4611686018427387904 * 2 - 1", {0, true}, result));
+    EXPECT_FALSE(evaluate("-(-4611686018427387904 * 2)", {0, true}, result));
+    EXPECT_FALSE(evaluate("1099511627776 / 0.000244140625", {12, true}, result));
+    EXPECT_FALSE(evaluate("-1099511627776 / 0.000244140625 - 0.000244140625", {12, true}, result));
+}
+
+TEST_P(TestFormulaInteger, fixedPointIntermediates)
+{
+    std::int64_t result{};
+
+    // The raw product and the scaled dividend exceed 64 bits, the results don't
+    ASSERT_TRUE(evaluate("65536 * 65536", {16, true}, result));
+    EXPECT_EQ(std::int64_t{1} << 48, result);
+    ASSERT_TRUE(evaluate("-1099511627776 / 0.5", {12, true}, result));
+    EXPECT_EQ(-(std::int64_t{1} << 53), result);
+    ASSERT_TRUE(evaluate("-549755813888 / 0.000244140625", {12, true}, result));
+    EXPECT_EQ(std::numeric_limits<std::int64_t>::min(), result);
+    EXPECT_FALSE(evaluate("549755813888 / 0.000244140625", {12, true}, result));
+    ASSERT_TRUE(evaluate("-3 / 2", {0, true}, result));
+    EXPECT_EQ(-1, result);
+}
+
+TEST_P(TestFormulaInteger, divideByZero)
+{
+    std::int64_t result{};
+
+    EXPECT_FALSE(evaluate("a/(b + 3)", {}, result));
+    EXPECT_FALSE(evaluate("a/0.001", {8}, result));
+}
+
+TEST_P(TestFormulaInteger, batch)
+{
+    const std::int64_t cents[]{199, 2500, -300, 0, 12345};
+    const std::int64_t quantity[]{3, 1, 2, 7, 4};
+    const std::int64_t *columns[]{cents, quantity};
+    std::int64_t results[5]{};
+    formula = formula::parse("cents*quantity + 5");
+    ASSERT_TRUE(formula);
+    formula->set_integer_format({0, true});
+    formula->set_batch_variables({"cents", "quantity"});
+    if (GetParam())
+    {
+        ASSERT_TRUE(formula->compile_integer_batch());
+    }
+
+    ASSERT_TRUE(formula->evaluate_integer_batch(columns, results, 5));
+
+    for (size_t i = 0; i < 5; ++i)
+    {
+        EXPECT_EQ(cents[i] * quantity[i] + 5, results[i]);
+    }
+}
+
+TEST_P(TestFormulaInteger, batchOverflow)
+{
+    const std::int64_t values[]{1, 2, std::numeric_limits<std::int64_t>::max()};
+    const std::int64_t *columns[]{values};
+    std::int64_t results[3]{};
+    formula = formula::parse("x + 1");
+    ASSERT_TRUE(formula);
+    formula->set_integer_format({0, true});
+    formula->set_batch_variables({"x"});
+    if (GetParam())
+    {
+        ASSERT_TRUE(formula->compile_integer_batch());
+    }
+
+    EXPECT_FALSE(formula->evaluate_integer_batch(columns, results, 3));
+    EXPECT_EQ(2, results[0]);
+    EXPECT_EQ(3, results[1]);
+}
+
+TEST_P(TestFormulaInteger, power)
+{
+    std::int64_t result{};
+
+    ASSERT_TRUE(evaluate("a^3 - b^2 + b^0", {}, result));
+    EXPECT_EQ(335, result);
+    ASSERT_TRUE(evaluate("1.5^2 + 2^-2", {16}, result));
+    EXPECT_EQ(163840, result); // 2.5 * 2^16
+    EXPECT_FALSE(evaluate("2^63", {0, true}, result));
+    EXPECT_FALSE(evaluate("0^-1", {}, result));
+    if (!GetParam())
+    {
+        EXPECT_FALSE(evaluate("a^b", {}, result));
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Modes, TestFormulaInteger, testing::Bool(), mode_name);
+
+namespace
+{
+
+class TestFormulaComplex : public ModeTest
+{
+protected:
+    std::complex<double> evaluate(const char *text)
+    {
+        formula = formula::parse(text);
+        EXPECT_TRUE(formula);
+        formula->set_value("x", 2.0);
+        formula->set_complex_value("z", {1.0, 2.0});
+        formula->set_complex_value("w", {3.0, -1.0});
+        if (GetParam())
+        {
+            EXPECT_TRUE(formula->compile_complex());
+        }
+        std::complex<double> result;
+        EXPECT_TRUE(formula->evaluate_complex(result));
+        return result;
+    }
+
+    std::shared_ptr<formula::Formula> formula;
+};
+
+} // namespace
+
+TEST_P(TestFormulaComplex, arithmetic)
+{
+    EXPECT_EQ(std::complex<double>(3.0, -1.0), evaluate("z*w/(1 + 2*i)"));
+    EXPECT_EQ(std::complex<double>(6.0, -3.0), evaluate("x*w - i - z + x*i + 0.5*(x - 1)/0.5"));
+    EXPECT_EQ(std::complex<double>(-1.0, -2.0), evaluate("-z + unknown"));
+    EXPECT_EQ(std::complex<double>(-3.0, 4.0), evaluate("t = z*z; t"));
+}
+
+TEST_P(TestFormulaComplex, power)
+{
+    formula = formula::parse("z^3 - z^-1 + z^0");
+    ASSERT_TRUE(formula);
+    formula->set_complex_value("z", {1.0, 1.0});
+    if (GetParam())
+    {
+        ASSERT_TRUE(formula->compile_complex());
+    }
+    std::complex<double> result;
+    ASSERT_TRUE(formula->evaluate_complex(result));
+    EXPECT_EQ(std::complex<double>(-1.5, 2.5), result);
+
+    formula = formula::parse("z^x");
+    ASSERT_TRUE(formula);
+    if (GetParam())
+    {
+        EXPECT_FALSE(formula->compile_complex());
+    }
+    EXPECT_FALSE(formula->evaluate_complex(result));
+}
+
+TEST_P(TestFormulaComplex, realSymbols)
+{
+    formula = formula::parse("z + i");
+    ASSERT_TRUE(formula);
+    formula->set_complex_value("z", {1.0, 2.0});
+    formula->set_value("z", 4.0);
+    if (GetParam())
+    {
+        ASSERT_TRUE(formula->compile_complex());
+    }
+
+    std::complex<double> result;
+    ASSERT_TRUE(formula->evaluate_complex(result));
+    EXPECT_EQ(std::complex<double>(4.0, 1.0), result);
+    EXPECT_DOUBLE_EQ(4.0, formula->evaluate());
+}
+
+TEST_P(TestFormulaComplex, batch)
+{
+    const std::complex<double> z[]{{0.0, 0.0}, {1.0, 1.0}, {-2.0, 0.5}, {0.25, -3.0}, {1e10, 1e-10}};
+    const std::complex<double> c[]{{-0.75, 0.1}, {0.0, 0.0}, {1.0, -1.0}, {0.5, 0.5}, {1.0, 0.0}};
+    const std::complex<double> *columns[]{z, c};
+    std::complex<double> results[5]{};
+    formula = formula::parse("z*z + c");
+    ASSERT_TRUE(formula);
+    formula->set_batch_variables({"z", "c"});
+    if (GetParam())
+    {
+        ASSERT_TRUE(formula->compile_complex_batch());
+    }
+
+    ASSERT_TRUE(formula->evaluate_complex_batch(columns, results, 5));
+
+    for (size_t i = 0; i < 5; ++i)
+    {
+        const double re = z[i].real() * z[i].real() - z[i].imag() * z[i].imag() + c[i].real();
+        const double im = z[i].imag() * z[i].real() + z[i].real() * z[i].imag() + c[i].imag();
+        EXPECT_EQ(std::complex<double>(re, im), results[i]);
+    }
+}
+
+TEST(TestFormulaComplexCompiled, matchesInterpreter)
+{
+    const auto formula{formula::parse("z = z*z + c; z = z*z + c; z = z*z + c; z^5/(c - z) - i/z")};
+    ASSERT_TRUE(formula);
+    formula->set_complex_value("c", {-0.7453, 0.1127});
+    std::complex<double> expected;
+    ASSERT_TRUE(formula->evaluate_complex(expected));
+
+    ASSERT_TRUE(formula->compile_complex());
+
+    std::complex<double> result;
+    ASSERT_TRUE(formula->evaluate_complex(result));
+    EXPECT_EQ(expected, result);
+}
+
+INSTANTIATE_TEST_SUITE_P(Modes, TestFormulaComplex, testing::Bool(), mode_name);
+
+namespace
+{
+
+class TestFormulaGrid : public ModeTest
+{
+protected:
+    void prepare(const char *text, std::vector<std::string> axes)
+    {
+        formula = formula::parse(text);
+        ASSERT_TRUE(formula);
+        formula->set_grid_variables(std::move(axes));
+        if (GetParam())
+        {
+            ASSERT_TRUE(formula->compile_grid());
+        }
+    }
+
+    static double coordinate(const formula::GridAxis &axis, size_t i)
+    {
+        return axis.start + static_cast<double>(i) * axis.step;
+    }
+
+    std::shared_ptr<formula::Formula> formula;
+};
+
+} // namespace
+
+TEST_P(TestFormulaGrid, stridedRows)
+{
+    const formula::GridAxis axes[]{{-1.0, 0.5, 5}, {0.0, 0.1, 3, 8}};
+    std::vector<double> results(24, -1.0);
+    prepare("x*x + 10*y", {"x", "y"});
+
+    ASSERT_TRUE(formula->evaluate_grid(axes, results.data(), 1));
+
+    for (size_t j = 0; j < 3; ++j)
+    {
+        for (size_t i = 0; i < 8; ++i)
+        {
+            const double x = coordinate(axes[0], i);
+            const double expected = i < 5 ? x * x + 10 * coordinate(axes[1], j) : -1.0;
+            EXPECT_EQ(expected, results[j * 8 + i]) << i << ", " << j;
+        }
+    }
+}
+
+TEST_P(TestFormulaGrid, threads)
+{
+    // Enough points for three threads, which small grids leave out
+    const formula::GridAxis axes[]{{0.0, 1.0, 65}, {0.5, 0.25, 32, 65}, {-2.0, 0.75, 24, 2080}};
+    std::vector<double> results(24 * 2080);
+    prepare("t = x + 10*y; t + 100*z", {"x", "y", "z"});
+
+    ASSERT_TRUE(formula->evaluate_grid(axes, results.data(), 3));
+
+    for (size_t k = 0; k < 24; ++k)
+    {
+        for (size_t j = 0; j < 32; ++j)
+        {
+            for (size_t i = 0; i < 65; ++i)
+            {
+                const double expected =
+                    coordinate(axes[0], i) + 10 * coordinate(axes[1], j) + 100 * coordinate(axes[2], k);
+                ASSERT_EQ(expected, results[k * 2080 + j * 65 + i]) << i << ", " << j << ", " << k;
+            }
+        }
+    }
+}
+
+TEST_P(TestFormulaGrid, singleAxis)
+{
+    const formula::GridAxis axes[]{{-3.0, 0.01, 601}};
+    std::vector<double> results(601);
+    prepare("x^3 - x", {"x"});
+
+    ASSERT_TRUE(formula->evaluate_grid(axes, results.data(), 4));
+
+    for (size_t i = 0; i < 601; ++i)
+    {
+        const double x = coordinate(axes[0], i);
+        EXPECT_EQ(x * x * x - x, results[i]);
+    }
+}
+
+TEST_P(TestFormulaGrid, invalidAxes)
+{
+    formula = formula::parse("x");
+    ASSERT_TRUE(formula);
+    formula->set_grid_variables({"a", "b", "c", "d"});
+    if (GetParam())
+    {
+        EXPECT_FALSE(formula->compile_grid());
+    }
+    EXPECT_FALSE(formula->evaluate_grid(nullptr, nullptr, 1));
+}
+
+INSTANTIATE_TEST_SUITE_P(Modes, TestFormulaGrid, testing::Bool(), mode_name);
+
+namespace
+{
+
+class TestFormulaIterate : public ModeTest
+{
+protected:
+    void prepare(const char *text, std::vector<std::string> columns, formula::IterationLimits limits)
+    {
+        formula = formula::parse(text);
+        ASSERT_TRUE(formula);
+        formula->set_batch_variables(std::move(columns));
+        formula->set_iteration_limits(limits);
+        if (GetParam())
+        {
+            ASSERT_TRUE(formula->compile_iteration());
+        }
+    }
+
+    std::shared_ptr<formula::Formula> formula;
+};
+
+} // namespace
+
+TEST_P(TestFormulaIterate, escapeTime)
+{
+    const double a[]{0.0, 1.0, 2.0, -1.0, 0.3};
+    const double b[]{0.0, 1.0, 0.0, 0.0, 0.5};
+    const double *columns[]{a, b};
+    double results[5]{};
+    std::uint32_t iterations[5]{};
+    prepare("t = x*x - y*y + a; y = 2*x*y + b; x = t; x*x + y*y", {"a", "b"}, {4.0, 100});
+
+    formula->iterate(columns, results, iterations, 5);
+
+    for (size_t i = 0; i < 5; ++i)
+    {
+        double x{};
+        double y{};
+        double value{};
+        std::uint32_t passes{};
+        while (passes < 100)
+        {
+            const double t = x * x - y * y + a[i];
+            y = 2 * x * y + b[i];
+            x = t;
+            value = x * x + y * y;
+            ++passes;
+            if (value > 4.0)
+            {
+                break;
+            }
+        }
+        EXPECT_EQ(value, results[i]) << i;
+        EXPECT_EQ(passes, iterations[i]) << i;
+    }
+    EXPECT_EQ(100U, iterations[0]);
+    EXPECT_EQ(2U, iterations[1]);
+    EXPECT_EQ(36.0, results[2]);
+}
+
+TEST_P(TestFormulaIterate, fixedPoint)
+{
+    const double a[]{2.0, 9.0, 16.0};
+    const double *columns[]{a};
+    double results[3]{};
+    std::uint32_t iterations[3]{};
+    formula = formula::parse("x = (x + a/x)/2");
+    ASSERT_TRUE(formula);
+    formula->set_value("x", 1.0);
+    formula->set_batch_variables({"a"});
+    formula->set_iteration_limits({std::numeric_limits<double>::infinity(), 20});
+    if (GetParam())
+    {
+        ASSERT_TRUE(formula->compile_iteration());
+    }
+
+    formula->iterate(columns, results, iterations, 3);
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        EXPECT_DOUBLE_EQ(std::sqrt(a[i]), results[i]);
+        EXPECT_EQ(20U, iterations[i]);
+    }
+}
+
+TEST_P(TestFormulaIterate, noPasses)
+{
+    const double x[]{1.0, 2.0, 3.0};
+    const double *columns[]{x};
+    double results[3]{-1.0, -1.0, -1.0};
+    std::uint32_t iterations[3]{7, 7, 7};
+    prepare("x = x + 1", {"x"}, {4.0, 0});
+
+    formula->iterate(columns, results, iterations, 3);
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        EXPECT_EQ(0.0, results[i]);
+        EXPECT_EQ(0U, iterations[i]);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Modes, TestFormulaIterate, testing::Bool(), mode_name);
+
+namespace
+{
+
+class TestFormulaSet : public ModeTest
+{
+protected:
+    void SetUp() override
+    {
+        formulas = formula::make_formula_set();
+        if (GetParam())
+        {
+            ASSERT_TRUE(formulas->compile());
+        }
+    }
+
+    std::shared_ptr<formula::FormulaSet> formulas;
+};
+
+} // namespace
+
+TEST_P(TestFormulaSet, references)
+{
+    ASSERT_TRUE(formulas->define("total", "net + tax"));
+    ASSERT_TRUE(formulas->define("tax", "net * rate"));
+    ASSERT_TRUE(formulas->define("net", "price * quantity"));
+    formulas->set_value("price", 2.5);
+    formulas->set_value("quantity", 4.0);
+    formulas->set_value("rate", 0.25);
+
+    EXPECT_EQ(12.5, formulas->get_value("total"));
+    EXPECT_EQ(2.5, formulas->get_value("tax"));
+    EXPECT_EQ(0.25, formulas->get_value("rate"));
+}
+
+TEST_P(TestFormulaSet, recalculatesAffectedFormulas)
+{
+    ASSERT_TRUE(formulas->define("a", "x + 1"));
+    ASSERT_TRUE(formulas->define("b", "y * 2"));
+    ASSERT_TRUE(formulas->define("c", "a * b"));
+    formulas->set_value("x", 1.0);
+    formulas->set_value("y", 3.0);
+    formulas->recalculate();
+    ASSERT_EQ(3U, formulas->evaluations());
+
+    formulas->set_value("x", 2.0);
+    EXPECT_EQ(18.0, formulas->get_value("c"));
+    EXPECT_EQ(5U, formulas->evaluations());
+    EXPECT_EQ(6.0, formulas->get_value("b"));
+    EXPECT_EQ(5U, formulas->evaluations());
+
+    ASSERT_TRUE(formulas->define("b", "y"));
+    EXPECT_EQ(9.0, formulas->get_value("c"));
+    EXPECT_EQ(7U, formulas->evaluations());
+}
+
+TEST_P(TestFormulaSet, parallelBranches)
+{
+    // Enough formulas for four threads, which small levels leave out
+    formulas->set_threads(4);
+    std::string sum = "0";
+    for (int i = 0; i < 256; ++i)
+    {
+        const std::string name = "f" + std::to_string(i);
+        ASSERT_TRUE(formulas->define(name, "x * " + std::to_string(i) + " + pi"));
+        sum += " + " + name;
+    }
+    ASSERT_TRUE(formulas->define("sum", sum));
+    formulas->set_value("x", 0.5);
+
+    const double pi = std::atan2(0.0, -1.0);
+    double expected = 0;
+    for (int i = 0; i < 256; ++i)
+    {
+        expected += 0.5 * i + pi;
+    }
+    EXPECT_DOUBLE_EQ(expected, formulas->get_value("sum"));
+    EXPECT_EQ(257U, formulas->evaluations());
+}
+
+TEST_P(TestFormulaSet, programLocals)
+{
+    ASSERT_TRUE(formulas->define("a", "t = 2; t * t"));
+    ASSERT_TRUE(formulas->define("t", "a + 1"));
+
+    EXPECT_EQ(5.0, formulas->get_value("t"));
+}
+
+TEST_P(TestFormulaSet, rejectsCycles)
+{
+    ASSERT_TRUE(formulas->define("a", "b + 1"));
+    ASSERT_TRUE(formulas->define("b", "c * 2"));
+    EXPECT_FALSE(formulas->define("c", "a - 1"));
+    EXPECT_FALSE(formulas->define("d", "d + 1"));
+    EXPECT_FALSE(formulas->define("e", "1 +"));
+    formulas->set_value("c", 3.0);
+
+    EXPECT_EQ(7.0, formulas->get_value("a"));
+}
+
+INSTANTIATE_TEST_SUITE_P(Modes, TestFormulaSet, testing::Bool(), mode_name);
+
+namespace
+{
+
+class TestFormulaRandom : public ModeTest
+{
+protected:
+    std::vector<double> evaluate(const char *text, std::size_t count)
+    {
+        const auto result{formula::parse(text)};
+        EXPECT_TRUE(result);
+        result->set_random_seed(seed, stream);
+        return evaluate(*result, count);
+    }
+    std::vector<double> evaluate(formula::BatchEvaluator &random, std::size_t count)
+    {
+        std::vector<double> x(count, 1.0);
+        const double *columns[]{x.data()};
+        random.set_batch_variables({"x"});
+        if (GetParam())
+        {
+            EXPECT_TRUE(random.compile_batch());
+        }
+        std::vector<double> results(count);
+        random.evaluate_batch(columns, results.data(), count);
+        return results;
+    }
+
+    std::uint32_t seed{12345};
+    std::uint32_t stream{};
+};
+
+} // namespace
+
+TEST_P(TestFormulaRandom, uniform)
+{
+    const std::vector<double> values = evaluate("x*rand()", 10001);
+    double sum{};
+    for (double value : values)
+    {
+        ASSERT_LE(0.0, value);
+        ASSERT_GT(1.0, value);
+        sum += value;
+    }
+    EXPECT_NEAR(0.5, sum / values.size(), 0.01);
+}
+
+TEST_P(TestFormulaRandom, knownAnswer)
+{
+    seed = 0;
+    const double expected = static_cast<double>(0xff1dae59ULL << 20 | 0x6cd10df2 >> 12) * 0x1p-52;
+
+    EXPECT_EQ(expected, evaluate("rand()", 3)[0]);
+}
+
+TEST_P(TestFormulaRandom, reproducible)
+{
+    const std::vector<double> values = evaluate("rand() + 2*normal()", 7);
+    EXPECT_EQ(values, evaluate("rand() + 2*normal()", 7));
+
+    const auto random{formula::parse("rand() + 2*normal()")};
+    ASSERT_TRUE(random);
+    random->set_random_seed(seed);
+    const std::vector<double> first = evaluate(*random, 3);
+    const std::vector<double> rest = evaluate(*random, 4);
+    EXPECT_EQ(values, (std::vector<double>{first[0], first[1], first[2], rest[0], rest[1], rest[2], rest[3]}));
+    random->set_random_seed(seed);
+    EXPECT_EQ(first, evaluate(*random, 3));
+}
+
+TEST_P(TestFormulaRandom, independentSitesAndStreams)
+{
+    const std::vector<double> values = evaluate("rand() - rand()", 5);
+    for (double value : values)
+    {
+        EXPECT_NE(0.0, value);
+    }
+    const std::vector<double> first = evaluate("rand()", 5);
+    stream = 1;
+    const std::vector<double> second = evaluate("rand()", 5);
+    for (std::size_t i = 0; i < first.size(); ++i)
+    {
+        EXPECT_NE(first[i], second[i]) << i;
+    }
+}
+
+TEST_P(TestFormulaRandom, normal)
+{
+    const std::vector<double> values = evaluate("normal()", 20001);
+    double sum{};
+    double squares{};
+    for (double value : values)
+    {
+        ASSERT_TRUE(std::isfinite(value));
+        sum += value;
+        squares += value * value;
+    }
+    const double mean = sum / values.size();
+    EXPECT_NEAR(0.0, mean, 0.03);
+    EXPECT_NEAR(1.0, squares / values.size() - mean * mean, 0.05);
+}
+
+TEST_P(TestFormulaRandom, needsBatch)
+{
+    const auto random{formula::parse("x + rand()")};
+    ASSERT_TRUE(random);
+    random->set_batch_variables({"x"});
+    if (GetParam())
+    {
+        EXPECT_FALSE(random->compile());
+        EXPECT_FALSE(random->compile_selection());
+    }
+    EXPECT_TRUE(std::isnan(random->evaluate()));
+    const double x[]{1.0, 2.0};
+    const double *columns[]{x};
+    const std::uint32_t selection[]{1};
+    double results[]{0.0, 0.0};
+    random->evaluate_selection(columns, selection, 1, results);
+    EXPECT_EQ(0.0, results[0]);
+    EXPECT_TRUE(std::isnan(results[1]));
+    std::int64_t result{};
+    EXPECT_FALSE(random->evaluate_integer(result));
+    std::complex<double> value;
+    EXPECT_FALSE(random->evaluate_complex(value));
+
+    // Grid points are NaN where the strides place them
+    const formula::GridAxis axes[]{{0.0, 1.0, 2}, {0.0, 1.0, 2, 4}};
+    std::vector<double> grid(8, 0.0);
+    random->set_grid_variables({"x", "y"});
+    EXPECT_FALSE(random->evaluate_grid(axes, grid.data(), 1));
+    for (std::size_t i = 0; i < grid.size(); ++i)
+    {
+        EXPECT_EQ(i % 4 < 2, std::isnan(grid[i])) << i;
+    }
+}
+
+TEST_P(TestFormulaRandom, stridedRows)
+{
+    struct Record
+    {
+        int id;
+        double x;
+    };
+    const std::vector<double> expected = evaluate("x + rand()", 5);
+    const std::vector<Record> records(expected.size(), Record{0, 1.0});
+    const auto random{formula::parse("x + rand()")};
+    ASSERT_TRUE(random);
+    random->set_random_seed(seed, stream);
+    random->set_batch_variables({"x"});
+    if (GetParam())
+    {
+        ASSERT_TRUE(random->compile_strided_batch());
+    }
+    const formula::StridedColumn columns[]{{records.data(), offsetof(Record, x), sizeof(Record)}};
+    std::vector<double> results(records.size());
+    random->evaluate_batch(columns, results.data(), 2);
+    random->evaluate_batch(columns, results.data() + 2, 3);
+    EXPECT_EQ(expected, results);
+}
+
+TEST(TestFormulaRandomCompiled, matchesInterpreter)
+{
+    // Odd counts leave a scalar tail after the packed rows
+    for (const std::size_t count : {1, 7, 101})
+    {
+        std::vector<double> x(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            x[i] = 0.5 + static_cast<double>(i);
+        }
+        const double *columns[]{x.data()};
+        std::vector<double> expected(count);
+        std::vector<double> results(count);
+        for (const bool compiled : {false, true})
+        {
+            const auto random{formula::parse("rand() + x*normal() - normal()")};
+            ASSERT_TRUE(random);
+            random->set_random_seed(2024, 3);
+            random->set_batch_variables({"x"});
+            if (compiled)
+            {
+                ASSERT_TRUE(random->compile_batch());
+            }
+            random->evaluate_batch(columns, (compiled ? results : expected).data(), count);
+        }
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            // The compiled logarithm of normal() differs from std::log in the last bits
+            EXPECT_NEAR(expected[i], results[i], (1.0 + x[i]) * 1e-11) << count << ' ' << i;
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Modes, TestFormulaRandom, testing::Bool(), mode_name);
+
+namespace
+{
+
+int g_native_calls{};
+
+double hypotenuse(double x, double y)
+{
+    ++g_native_calls;
+    return std::sqrt(x * x + y * y);
+}
+
+double clamp_unit(double x)
+{
+    ++g_native_calls;
+    return std::min(std::max(x, 0.0), 1.0);
+}
+
+double five(double, double, double, double, double)
+{
+    return 5.0;
+}
+
+// clamp_unit with minsd/maxsd or their packed forms on the caller's registers
+bool emit_clamp_unit(asmjit::x86::Compiler &comp, const formula::InlineCall &call)
+{
+    if (call.single)
+    {
+        return false;
+    }
+    asmjit::x86::Xmm bound = comp.newXmm();
+    comp.xorpd(bound, bound);
+    comp.movapd(call.result, call.arguments[0]);
+    call.packed ? comp.maxpd(call.result, bound) : comp.maxsd(call.result, bound);
+    asmjit::x86::Gp one = comp.newInt64();
+    comp.mov(one, 0x3FF0000000000000);
+    comp.movq(bound, one);
+    if (call.packed)
+    {
+        comp.unpcklpd(bound, bound);
+    }
+    call.packed ? comp.minpd(call.result, bound) : comp.minsd(call.result, bound);
+    return true;
+}
+
+void register_functions()
+{
+    ASSERT_TRUE(formula::register_function("hypotenuse", hypotenuse));
+    ASSERT_TRUE(formula::register_function("clamp_unit", clamp_unit, emit_clamp_unit));
+}
+
+class TestFormulaFunction : public ModeTest
+{
+protected:
+    void SetUp() override
+    {
+        register_functions();
+        g_native_calls = 0;
+    }
+
+    std::vector<double> evaluate(const char *text, std::vector<double> x, std::vector<double> y)
+    {
+        const auto result{formula::parse(text)};
+        EXPECT_TRUE(result);
+        result->set_batch_variables({"x", "y"});
+        if (GetParam())
+        {
+            EXPECT_TRUE(result->compile_batch());
+        }
+        const double *columns[]{x.data(), y.data()};
+        std::vector<double> results(x.size());
+        result->evaluate_batch(columns, results.data(), x.size());
+        return results;
+    }
+};
+
+} // namespace
+
+TEST_P(TestFormulaFunction, native)
+{
+    const auto result{formula::parse("1 + hypotenuse(a, b*2)")};
+    ASSERT_TRUE(result);
+    result->set_value("a", 3.0);
+    result->set_value("b", 2.0);
+    if (GetParam())
+    {
+        ASSERT_TRUE(result->compile());
+    }
+
+    EXPECT_EQ(6.0, result->evaluate());
+    EXPECT_EQ(1, g_native_calls);
+}
+
+TEST_P(TestFormulaFunction, nativeBatch)
+{
+    const std::vector<double> results =
+        evaluate("hypotenuse(x, y) - x", {3.0, 5.0, 8.0, 7.0, 20.0}, {4.0, 12.0, 15.0, 24.0, 21.0});
+
+    EXPECT_EQ((std::vector<double>{2.0, 8.0, 9.0, 18.0, 9.0}), results);
+    EXPECT_EQ(5, g_native_calls);
+}
+
+TEST_P(TestFormulaFunction, inlineBatch)
+{
+    const std::vector<double> results =
+        evaluate("clamp_unit(x*y)", {-1.0, 0.25, 2.0, 0.5, 3.0}, {1.0, 2.0, 0.25, 3.0, 1.0});
+
+    EXPECT_EQ((std::vector<double>{0.0, 0.5, 0.5, 1.0, 1.0}), results);
+    EXPECT_EQ(GetParam() ? 0 : 5, g_native_calls);
+}
+
+TEST(TestFormulaFunctionRegistry, parse)
+{
+    register_functions();
+    EXPECT_TRUE(formula::parse("hypotenuse(1, clamp_unit(2))"));
+    EXPECT_FALSE(formula::parse("hypotenuse(1)"));
+    EXPECT_FALSE(formula::parse("hypotenuse(1, 2,)"));
+    EXPECT_FALSE(formula::parse("rand(1)"));
+    EXPECT_FALSE(formula::parse("undefined(1)"));
+    EXPECT_TRUE(formula::parse_fast("hypotenuse(1, clamp_unit(2))"));
+    EXPECT_FALSE(formula::parse_fast("hypotenuse(1)"));
+    EXPECT_FALSE(formula::parse_fast("hypotenuse(1, 2,)"));
+    EXPECT_FALSE(formula::parse_fast("rand(1)"));
+    EXPECT_FALSE(formula::parse_fast("undefined(1)"));
+}
+
+TEST(TestFormulaFunctionInterpreted, gradientAndInteger)
+{
+    register_functions();
+    const auto result{formula::parse("hypotenuse(x, 2*y)")};
+    ASSERT_TRUE(result);
+    result->set_gradient_variables({"x", "y"});
+    const double values[2]{3.0, 2.0};
+    double gradient[2]{};
+
+    EXPECT_NEAR(5.0, result->evaluate_gradient(values, gradient), 1e-12);
+    EXPECT_NEAR(0.6, gradient[0], 1e-9);
+    EXPECT_NEAR(1.6, gradient[1], 1e-9);
+    EXPECT_FALSE(result->compile_gradient());
+    std::int64_t integer{};
+    EXPECT_FALSE(result->evaluate_integer(integer));
+    std::complex<double> value;
+    EXPECT_FALSE(result->evaluate_complex(value));
+}
+
+TEST(TestFormulaFunctionCompiled, failsInsideExpressions)
+{
+    // Complex kernels don't support calls, however deep the call sits in the expression
+    register_functions();
+    const auto result{formula::parse("1 + 2*hypotenuse(z, 2)")};
+    ASSERT_TRUE(result);
+    result->set_complex_value("z", {1.0, 2.0});
+    EXPECT_FALSE(result->compile_complex());
+    result->set_batch_variables({"z"});
+    EXPECT_FALSE(result->compile_complex_batch());
+}
+
+TEST(TestFormulaFunctionRegistry, invalidRegistrations)
+{
+    EXPECT_FALSE(formula::register_function("rand", clamp_unit));
+    EXPECT_FALSE(formula::register_function("1x", clamp_unit));
+    EXPECT_FALSE(formula::register_function("", clamp_unit));
+    EXPECT_FALSE(formula::register_function("five", five));
+}
+
+INSTANTIATE_TEST_SUITE_P(Modes, TestFormulaFunction, testing::Bool(), mode_name);
+
+namespace
+{
+
+constexpr char STATIC_POLYNOMIAL[] = "a*a*a - 2*a*b + -b/4 + 1.5e1";
+constexpr char STATIC_PROGRAM[] = "t = a + 1; u = t*t; u - b;";
+constexpr char STATIC_CONSTANTS[] = "2*pi + e - unknown";
+constexpr char STATIC_PRECEDENCE[] = "1 - 2 - 3/4/5*-(6) + +7";
+constexpr char STATIC_POWER[] = "2^3^2 - a^-2 + -a^0";
+constexpr char STATIC_GENERAL_POWER[] = "a^b + a^7";
+constexpr char STATIC_LONG_CHAINS[] = "a^191 + a^223 - a^239 + a^-256 + a^1073741824";
+
+} // namespace
+
+static_assert(formula::StaticFormula<STATIC_POLYNOMIAL>::slot("b") == 1);
+static_assert(formula::StaticFormula<STATIC_POLYNOMIAL>::slot("c") == formula::detail::NO_SLOT);
+static_assert(formula::StaticFormula<STATIC_PRECEDENCE>::evaluate({}) == 1.0 - 2.0 - 3.0 / 4.0 / 5.0 * -6.0 + 7.0);
+static_assert(formula::StaticFormula<STATIC_POWER>::evaluate({2.0}) == 512.0 - 0.25 - 1.0);
+static_assert(formula::detail::addition_chain(15).length == 6);
+static_assert(formula::detail::addition_chain(191).length == 12);
+static_assert(formula::detail::addition_chain(256).length == 9);
+static_assert(!formula::detail::is_chain_exponent(257));
+static_assert(formula::detail::static_parse<16>("x + 2*rand()").call);
+static_assert(!formula::detail::static_parse<16>("x + 2*(rand)").call);
+
+TEST(TestStaticFormula, matchesParse)
+{
+    formula::StaticFormula<STATIC_POLYNOMIAL> formula;
+    const auto parsed{formula::parse(STATIC_POLYNOMIAL)};
+    ASSERT_TRUE(parsed);
+    for (double a : {-2.5, 0.0, 3.0})
+    {
+        formula.set_value("a", a);
+        formula.set_value("b", 7.25);
+        parsed->set_value("a", a);
+        parsed->set_value("b", 7.25);
+
+        EXPECT_EQ(parsed->evaluate(), formula.evaluate());
+    }
+}
+
+TEST(TestStaticFormula, program)
+{
+    formula::StaticFormula<STATIC_PROGRAM> formula;
+    formula.set_value("a", 2.0);
+    formula.set_value(formula.slot("b"), 4.0);
+
+    EXPECT_EQ(5.0, formula.evaluate());
+    EXPECT_EQ(3.0, formula.get_value("t"));
+    EXPECT_EQ(9.0, formula.get_value("u"));
+    EXPECT_EQ(2.0, formula.get_value("a"));
+}
+
+TEST(TestStaticFormula, predefinedAndUnknownIdentifiers)
+{
+    formula::StaticFormula<STATIC_CONSTANTS> formula;
+
+    EXPECT_EQ(formula::parse(STATIC_CONSTANTS)->evaluate(), formula.evaluate());
+}
+
+TEST(TestStaticFormula, power)
+{
+    formula::StaticFormula<STATIC_GENERAL_POWER> formula;
+    const auto parsed{formula::parse(STATIC_GENERAL_POWER)};
+    ASSERT_TRUE(parsed);
+    formula.set_value("a", 1.25);
+    formula.set_value("b", -0.75);
+    parsed->set_value("a", 1.25);
+    parsed->set_value("b", -0.75);
+
+    EXPECT_EQ(parsed->evaluate(), formula.evaluate());
+}
+
+TEST(TestStaticFormula, longChains)
+{
+    formula::StaticFormula<STATIC_LONG_CHAINS> formula;
+    const auto parsed{formula::parse(STATIC_LONG_CHAINS)};
+    ASSERT_TRUE(parsed);
+    formula.set_value("a", 1.0000000123);
+    parsed->set_value("a", 1.0000000123);
+
+    EXPECT_EQ(parsed->evaluate(), formula.evaluate());
+}
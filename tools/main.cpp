@@ -1,18 +1,330 @@
 #include <formula/formula.h>
 
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <vector>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
 namespace
 {
 
+constexpr std::size_t BATCH_ROWS{4096};
+constexpr std::size_t CHUNK_SIZE{1 << 20};
+
+// Reads the input in large chunks and hands out complete lines.  A line is only valid
+// until the next call.
+class LineReader
+{
+public:
+    explicit LineReader(std::FILE *file) :
+        m_file(file),
+        m_buffer(CHUNK_SIZE)
+    {
+    }
+
+    bool next_line(std::string_view &line);
+
+private:
+    bool fill();
+
+    std::FILE *m_file;
+    std::vector<char> m_buffer;
+    std::size_t m_begin{};
+    std::size_t m_end{};
+};
+
+bool LineReader::fill()
+{
+    // Keep the unconsumed partial line and read after it
+    std::copy(m_buffer.begin() + m_begin, m_buffer.begin() + m_end, m_buffer.begin());
+    m_end -= m_begin;
+    m_begin = 0;
+    if (m_end == m_buffer.size())
+    {
+        m_buffer.resize(m_buffer.size() * 2);
+    }
+    const std::size_t count = std::fread(m_buffer.data() + m_end, 1, m_buffer.size() - m_end, m_file);
+    m_end += count;
+    return count > 0;
+}
+
+bool LineReader::next_line(std::string_view &line)
+{
+    const auto find_newline = [this]
+    {
+        return static_cast<std::size_t>(
+            std::find(m_buffer.begin() + m_begin, m_buffer.begin() + m_end, '\n') - m_buffer.begin());
+    };
+    std::size_t newline = find_newline();
+    while (newline == m_end && fill())
+    {
+        newline = find_newline();
+    }
+    if (m_begin == m_end)
+    {
+        return false;
+    }
+
+    line = std::string_view(m_buffer.data() + m_begin, newline - m_begin);
+    m_begin = std::min(newline + 1, m_end);
+    if (!line.empty() && line.back() == '\r')
+    {
+        line.remove_suffix(1);
+    }
+    return true;
+}
+
+// Collects output in a large buffer so results are written without per-value stream overhead.
+class ChunkWriter
+{
+public:
+    explicit ChunkWriter(std::FILE *file) :
+        m_file(file)
+    {
+        m_buffer.reserve(CHUNK_SIZE + 64);
+    }
+    ~ChunkWriter()
+    {
+        flush();
+    }
+
+    void write_text(double value)
+    {
+        char text[64];
+        const auto [end, ec] = std::to_chars(text, text + sizeof(text) - 1, value);
+        *end = '\n';
+        write(text, end + 1 - text);
+    }
+    void write_binary(const double *values, std::size_t count)
+    {
+        write(reinterpret_cast<const char *>(values), count * sizeof(double));
+    }
+    void flush()
+    {
+        std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file);
+        m_buffer.clear();
+        std::fflush(m_file);
+    }
+
+private:
+    void write(const char *data, std::size_t size)
+    {
+        m_buffer.insert(m_buffer.end(), data, data + size);
+        if (m_buffer.size() >= CHUNK_SIZE)
+        {
+            flush();
+        }
+    }
+
+    std::FILE *m_file;
+    std::vector<char> m_buffer;
+};
+
+std::string_view trim(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+    {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t'))
+    {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+std::vector<std::string> split_names(std::string_view text)
+{
+    std::vector<std::string> names;
+    while (true)
+    {
+        const std::size_t comma = text.find(',');
+        names.emplace_back(trim(text.substr(0, comma)));
+        if (comma == std::string_view::npos)
+        {
+            return names;
+        }
+        text.remove_prefix(comma + 1);
+    }
+}
+
+bool parse_row(std::string_view line, std::vector<std::vector<double>> &columns, std::size_t row)
+{
+    for (std::size_t i = 0; i < columns.size(); ++i)
+    {
+        const std::size_t comma = i + 1 < columns.size() ? line.find(',') : line.size();
+        if (comma == std::string_view::npos)
+        {
+            return false;
+        }
+        const std::string_view field = trim(line.substr(0, comma));
+        const auto [end, ec] = std::from_chars(field.data(), field.data() + field.size(), columns[i][row]);
+        if (ec != std::errc() || end != field.data() + field.size())
+        {
+            return false;
+        }
+        line.remove_prefix(std::min(comma + 1, line.size()));
+    }
+    return true;
+}
+
+// Closes opened input files but leaves standard input alone.
+struct FileCloser
+{
+    void operator()(std::FILE *file) const
+    {
+        if (file != stdin)
+        {
+            std::fclose(file);
+        }
+    }
+};
+
+using FileHandle = std::unique_ptr<std::FILE, FileCloser>;
+
+// Evaluates the formula over every row of the input and writes one result per row.
+// CSV input starts with a header line naming the columns; binary input is row-major
+// doubles with the columns named on the command line.
+int stream(formula::Formula &formula, bool compile, bool binary, const std::string &input,
+    std::vector<std::string> columns)
+{
+    const FileHandle file(input.empty() ? stdin : std::fopen(input.c_str(), "rb"));
+    if (!file)
+    {
+        std::cerr << "Error: Cannot open " << input << '\n';
+        return 1;
+    }
+#ifdef _WIN32
+    if (binary)
+    {
+        _setmode(_fileno(stdin), _O_BINARY);
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+
+    LineReader reader(file.get());
+    std::string_view line;
+    if (!binary)
+    {
+        if (!reader.next_line(line))
+        {
+            std::cerr << "Error: Missing CSV header\n";
+            return 1;
+        }
+        columns = split_names(line);
+    }
+    if (columns.empty())
+    {
+        std::cerr << "Error: No input columns\n";
+        return 1;
+    }
+
+    formula.set_batch_variables(columns);
+    if (compile && !(binary ? formula.compile_strided_batch() : formula.compile_batch()))
+    {
+        std::cerr << "Error: Failed to compile formula\n";
+        return 1;
+    }
+
+    std::vector<std::vector<double>> values(columns.size(), std::vector<double>(binary ? 0 : BATCH_ROWS));
+    std::vector<const double *> pointers;
+    for (const std::vector<double> &column : values)
+    {
+        pointers.push_back(column.data());
+    }
+    // Binary rows are evaluated in place as an array of structs
+    const std::size_t row_size = columns.size() * sizeof(double);
+    std::vector<double> rows(binary ? BATCH_ROWS * columns.size() : 0);
+    std::vector<formula::StridedColumn> strided;
+    for (std::size_t i = 0; i < columns.size(); ++i)
+    {
+        strided.push_back({rows.data(), i * sizeof(double), row_size});
+    }
+    std::vector<double> results(BATCH_ROWS);
+    ChunkWriter writer(stdout);
+    std::size_t line_number{1};
+    std::size_t row_number{};
+    while (true)
+    {
+        std::size_t count{};
+        std::size_t incomplete{};
+        if (binary)
+        {
+            const std::size_t size = std::fread(rows.data(), 1, BATCH_ROWS * row_size, file.get());
+            count = size / row_size;
+            incomplete = std::ferror(file.get()) ? 0 : size % row_size;
+            row_number += count;
+        }
+        else
+        {
+            while (count < BATCH_ROWS && reader.next_line(line))
+            {
+                ++line_number;
+                if (trim(line).empty())
+                {
+                    continue;
+                }
+                if (!parse_row(line, values, count))
+                {
+                    std::cerr << "Error: Invalid row at line " << line_number << '\n';
+                    return 1;
+                }
+                ++count;
+            }
+        }
+        if (count == 0 && incomplete == 0)
+        {
+            break;
+        }
+
+        if (binary)
+        {
+            formula.evaluate_batch(strided.data(), results.data(), count);
+            writer.write_binary(results.data(), count);
+            if (incomplete != 0)
+            {
+                std::cerr << "Error: Incomplete row " << row_number + 1 << " of " << incomplete << " bytes\n";
+                return 1;
+            }
+        }
+        else
+        {
+            formula.evaluate_batch(pointers.data(), results.data(), count);
+            for (std::size_t row = 0; row < count; ++row)
+            {
+                writer.write_text(results[row]);
+            }
+        }
+    }
+
+    if (std::ferror(file.get()))
+    {
+        std::cerr << "Error: Cannot read " << (input.empty() ? "standard input" : input) << '\n';
+        return 1;
+    }
+    return 0;
+}
+
 int main(const std::vector<std::string_view> &args)
 {
     bool assemble{};
     bool compile{};
+    bool streaming{};
+    bool binary{};
+    std::string text;
+    std::string input;
+    std::vector<std::string> columns;
     std::map<std::string, double> values;
     for (size_t i = 1; i < args.size(); ++i)
     {
@@ -24,7 +336,27 @@ int main(const std::vector<std::string_view> &args)
         {
             compile = true;
         }
-        else if (auto pos = args[i].find('='); pos != std::string_view::npos)
+        else if (args[i] == "--stream")
+        {
+            streaming = true;
+        }
+        else if (args[i] == "--binary")
+        {
+            binary = true;
+        }
+        else if (args[i].substr(0, 10) == "--formula=")
+        {
+            text = args[i].substr(10);
+        }
+        else if (args[i].substr(0, 8) == "--input=")
+        {
+            input = args[i].substr(8);
+        }
+        else if (args[i].substr(0, 10) == "--columns=")
+        {
+            columns = split_names(args[i].substr(10));
+        }
+        else if (auto pos = args[i].find('='); pos != std::string_view::npos && args[i].substr(0, 2) != "--")
         {
             std::string name{args[i].substr(0, pos)};
             std::string value{args[i].substr(pos + 1)};
@@ -32,15 +364,26 @@ int main(const std::vector<std::string_view> &args)
         }
         else
         {
-            std::cerr << "Usage: " << args[0] << " [--assemble | --compile] [name=value] ... [name=value]\n";
+            std::cerr << "Usage: " << args[0]
+                      << " [--assemble | --compile] [--formula=text] [name=value] ... [name=value]\n"
+                      << "       " << args[0]
+                      << " --stream [--compile] --formula=text [--input=file] [--binary --columns=a,b,...]"
+                         " [name=value] ... [name=value]\n";
             return 1;
         }
     }
+    if (streaming && (text.empty() || assemble || (binary && columns.empty())))
+    {
+        std::cerr << "Error: --stream needs --formula, --binary needs --columns and --assemble is not supported\n";
+        return 1;
+    }
 
-    std::cout << "Enter an expression:\n";
-    std::string line;
-    std::getline(std::cin, line);
-    std::shared_ptr<formula::Formula> formula = formula::parse(line);
+    if (text.empty())
+    {
+        std::cout << "Enter an expression:\n";
+        std::getline(std::cin, text);
+    }
+    std::shared_ptr<formula::Formula> formula = formula::parse(text);
     if (!formula)
     {
         std::cerr << "Error: Invalid formula\n";
@@ -51,6 +394,13 @@ int main(const std::vector<std::string_view> &args)
         formula->set_value(name, value);
     }
 
+    if (streaming)
+    {
+        // stdout carries the results
+        formula->set_log_file(nullptr);
+        return stream(*formula, compile, binary, input, std::move(columns));
+    }
+
     if (assemble && !formula->assemble())
     {
         std::cerr << "Error: Failed to assemble formula\n";